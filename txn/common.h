@@ -3,6 +3,7 @@
 #define _COMMON_H_
 
 #include <assert.h>
+#include <sched.h>
 #include <stdint.h>
 #include <sys/time.h>
 #include <unistd.h>
@@ -61,6 +62,24 @@ static inline void Sleep(double duration) {
   usleep(1000000 * duration);
 }
 
+// Number of times a thread waiting for another one spins before it starts
+// yielding its CPU instead.
+#define SPIN_LIMIT 64
+
+// Called once per iteration of a loop that waits for another thread, with
+// '*spins' counting the iterations from 0. Tells the CPU that the thread is
+// spinning, and after SPIN_LIMIT iterations yields the CPU, so that a waiter
+// never keeps the thread it waits for from running.
+static inline void SpinWait(int* spins) {
+  if (++*spins < SPIN_LIMIT) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#endif
+  } else {
+    sched_yield();
+  }
+}
+
 // Returns a human-readable string representation of an int.
 static inline string IntToString(int n) {
   char s[64];
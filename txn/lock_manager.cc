@@ -2,152 +2,782 @@
 // Lock manager implementing deterministic two-phase locking as described in
 // 'The Case for Determinism in Database Systems'.
 #include "lock_manager.h"
+#include <algorithm>
+#include "storage.h"
 #include "txn.h"
-using std::deque;
 using std::make_pair;
+using std::pair;
 
-LockManagerA::LockManagerA(deque<Txn *> *ready_txns)
+// Keys at or above this value name granules rather than records.
+#define GRANULE_KEY_BASE (1ULL << 63)
+
+// Lock compatibility matrix, indexed by LockMode.
+static const bool COMPATIBLE[6][6] = {
+    //         -      S      X      IS     IX     SIX
+    /* -   */ {true, true, true, true, true, true},
+    /* S   */ {true, true, false, true, false, false},
+    /* X   */ {true, false, false, false, false, false},
+    /* IS  */ {true, true, false, true, true, true},
+    /* IX  */ {true, false, false, true, true, false},
+    /* SIX */ {true, false, false, true, false, false},
+};
+
+bool LockManager::Compatible(LockMode a, LockMode b)
+{
+  return COMPATIBLE[a][b];
+}
+
+LockManagerA::LockManagerA(AtomicQueue<Txn *> *ready_txns,
+                           DeadlockPolicy policy)
+    : policy_(policy)
 {
   ready_txns_ = ready_txns;
+  abort_count_ = 0;
 }
 
-bool LockManagerA::WriteLock(Txn *txn, const Key &key)
+LockManagerA::~LockManagerA()
 {
-  // look up if the key is being locked
-  auto it = lock_table_.find(key);
-  auto waiting_tx_it = txn_waits_.find(txn);
-  if (it == lock_table_.end() || it->second->empty()) // not found
+  for (int i = 0; i < LOCK_TABLE_SHARDS; i++)
   {
-    // lock the key
-    LockRequest new_lock_request = LockRequest(EXCLUSIVE, txn);
-    deque<LockRequest> *lock_requests = new deque<LockRequest>;
-    lock_requests->push_back(new_lock_request);
-    lock_table_.insert(make_pair(key, lock_requests));
-    if (waiting_tx_it != txn_waits_.end()) // delete from waiting tx
+    LockTableShard *shard = &shards_[i];
+    for (auto it = shard->lock_table_.begin(); it != shard->lock_table_.end(); ++it)
     {
-      txn_waits_.erase(waiting_tx_it);
+      LockRequest *request = it->second->head_;
+      while (request != NULL)
+      {
+        LockRequest *next = request->next_;
+        delete request;
+        request = next;
+      }
+      delete it->second;
     }
-    return true;
+    while (shard->free_requests_ != NULL)
+    {
+      LockRequest *next = shard->free_requests_->next_;
+      delete shard->free_requests_;
+      shard->free_requests_ = next;
+    }
+    while (shard->free_queues_ != NULL)
+    {
+      LockQueue *next = shard->free_queues_->next_free_;
+      delete shard->free_queues_;
+      shard->free_queues_ = next;
+    }
+  }
+}
+
+LockQueue *LockManagerA::Requests(LockTableShard *shard, const Key &key)
+{
+  auto it = shard->lock_table_.find(key);
+  if (it != shard->lock_table_.end())
+  {
+    return it->second;
   }
-  vector<Txn *> owners = vector<Txn *>{};
-  LockMode mode = this->Status(key, &owners);
-  if (mode == SHARED && owners.size() == 1 && owners[0] == txn)
+  LockQueue *lock_requests = shard->free_queues_;
+  if (lock_requests != NULL)
+  {
+    shard->free_queues_ = lock_requests->next_free_;
+  }
+  else
+  {
+    lock_requests = new LockQueue;
+  }
+  lock_requests->head_ = NULL;
+  lock_requests->tail_ = NULL;
+  shard->lock_table_.insert(make_pair(key, lock_requests));
+  return lock_requests;
+}
+
+bool LockManagerA::WriteLock(Txn *txn, const Key &key)
+{
+  return Request(txn, key, EXCLUSIVE);
+}
+
+bool LockManagerA::ReadLock(Txn *txn, const Key &key)
+{
+  return Request(txn, key, SHARED);
+}
+
+bool LockManagerA::GranuleLock(Txn *txn, const Key &key, LockMode mode)
+{
+  return Request(txn, GRANULE_KEY_BASE | (key / LOCK_GRANULE_SIZE), mode);
+}
+
+bool LockManagerA::Request(Txn *txn, const Key &key, LockMode mode)
+{
+  LockTableShard *shard = Shard(key);
+  shard->latch_.Lock();
+  LockQueue *lock_requests = Requests(shard, key);
+
+  // a request is granted iff it is compatible with every request ahead of it
+  vector<Txn *> blockers;
+  for (LockRequest *it = lock_requests->head_; it != NULL; it = it->next_)
   {
-    this->Release(txn, key);
-    deque<LockRequest> *lock_requests = it->second;
-    lock_requests->push_back(LockRequest(EXCLUSIVE, txn)); // add to lock requests in the key
-    if (waiting_tx_it != txn_waits_.end())                 // delete from waiting tx
+    if (!Compatible(mode, it->mode_))
     {
-      txn_waits_.erase(waiting_tx_it);
+      blockers.push_back(it->txn_);
     }
+  }
+
+  if (blockers.empty())
+  {
+    Enqueue(shard, lock_requests, txn, key, mode, true);
+    shard->latch_.Unlock();
     return true;
   }
-  if (owners.size() > 0)
+
+  waits_latch_.Lock();
+  // a txn that has been aborted stops queueing requests
+  if (aborted_txns_.count(txn) == 0 && MayWait(txn, blockers))
   {
-    if (owners[0] == txn && mode == EXCLUSIVE)
+    Enqueue(shard, lock_requests, txn, key, mode, false);
+    txn_waits_[txn]++;
+    if (policy_ == DETECT)
     {
-      return true;
+      DetectDeadlock(txn);
     }
   }
+  waits_latch_.Unlock();
+  shard->latch_.Unlock();
   return false;
 }
 
-bool LockManagerA::ReadLock(Txn *txn, const Key &key)
+void LockManagerA::Enqueue(LockTableShard *shard, LockQueue *lock_requests,
+                           Txn *txn, const Key &key, LockMode mode,
+                           bool granted)
 {
-  // look up if the key is being locked
-  auto it = lock_table_.find(key);
-  auto waiting_tx_it = txn_waits_.find(txn);
-  if (it == lock_table_.end()) // not found
+  LockRequest *request = shard->free_requests_;
+  if (request != NULL)
+  {
+    shard->free_requests_ = request->next_;
+  }
+  else
   {
-    // lock the key
-    LockRequest new_lock_request = LockRequest(SHARED, txn);
-    deque<LockRequest> *lock_requests = new deque<LockRequest>;
-    lock_requests->push_front(new_lock_request);
-    lock_table_.insert(make_pair(key, lock_requests));
-    if (waiting_tx_it != txn_waits_.end()) // delete from waiting tx
+    request = new LockRequest;
+  }
+  request->txn_ = txn;
+  request->mode_ = mode;
+  request->granted_ = granted;
+  request->key_ = key;
+  request->queue_ = lock_requests;
+
+  request->prev_ = lock_requests->tail_;
+  request->next_ = NULL;
+  if (lock_requests->tail_ != NULL)
+  {
+    lock_requests->tail_->next_ = request;
+  }
+  else
+  {
+    lock_requests->head_ = request;
+  }
+  lock_requests->tail_ = request;
+
+  request->txn_next_ = txn->lock_requests_;
+  txn->lock_requests_ = request;
+}
+
+bool LockManagerA::AcquireAll(Txn *txn, const set<Key> &readset,
+                              const set<Key> &writeset,
+                              const map<Key, LockMode> &granules)
+{
+  vector<pair<Key, LockMode> > requests;
+  requests.reserve(readset.size() + writeset.size() + granules.size());
+  for (map<Key, LockMode>::const_iterator it = granules.begin();
+       it != granules.end(); ++it)
+  {
+    requests.push_back(make_pair(GRANULE_KEY_BASE | (it->first / LOCK_GRANULE_SIZE),
+                                 it->second));
+  }
+  for (set<Key>::const_iterator it = readset.begin(); it != readset.end(); ++it)
+  {
+    requests.push_back(make_pair(*it, SHARED));
+  }
+  for (set<Key>::const_iterator it = writeset.begin(); it != writeset.end(); ++it)
+  {
+    requests.push_back(make_pair(*it, EXCLUSIVE));
+  }
+  sort(requests.begin(), requests.end(),
+       [this](const pair<Key, LockMode> &a, const pair<Key, LockMode> &b)
+       {
+         LockTableShard *shard_a = Shard(a.first);
+         LockTableShard *shard_b = Shard(b.first);
+         return shard_a != shard_b ? shard_a < shard_b : a.first < b.first;
+       });
+
+  // requests are made strictly in order, so the ones the txn has already made
+  // are a prefix of 'requests'
+  size_t next = 0;
+  for (LockRequest *it = txn->lock_requests_; it != NULL; it = it->txn_next_)
+  {
+    next++;
+  }
+
+  while (next < requests.size())
+  {
+    LockTableShard *shard = Shard(requests[next].first);
+    shard->latch_.Lock();
+    for (; next < requests.size() && Shard(requests[next].first) == shard; next++)
     {
+      const Key &key = requests[next].first;
+      LockMode mode = requests[next].second;
+      LockQueue *lock_requests = Requests(shard, key);
+      bool granted = true;
+      for (LockRequest *it = lock_requests->head_; granted && it != NULL;
+           it = it->next_)
+      {
+        granted = Compatible(mode, it->mode_);
+      }
+      Enqueue(shard, lock_requests, txn, key, mode, granted);
+      if (!granted)
+      {
+        // park until this request is granted
+        waits_latch_.Lock();
+        txn_waits_[txn] = 1;
+        waits_latch_.Unlock();
+        shard->latch_.Unlock();
+        return false;
+      }
+    }
+    shard->latch_.Unlock();
+  }
+  return true;
+}
 
-      txn_waits_.erase(waiting_tx_it);
+bool LockManagerA::MayWait(Txn *txn, const vector<Txn *> &blockers)
+{
+  switch (policy_)
+  {
+  case WAIT_DIE:
+    // a txn never waits for an older one, so waits-for edges always point from
+    // older to younger txns and can never form a cycle
+    for (auto it = blockers.begin(); it != blockers.end(); ++it)
+    {
+      if ((*it)->unique_id_ < txn->unique_id_)
+      {
+        Abort(txn);
+        return false;
+      }
+    }
+    return true;
+  case WOUND_WAIT:
+    // younger txns in the way are aborted unless they already hold all of
+    // their locks, in which case they will finish and release them anyway
+    for (auto it = blockers.begin(); it != blockers.end(); ++it)
+    {
+      if ((*it)->unique_id_ > txn->unique_id_ && txn_waits_.count(*it) > 0)
+      {
+        Abort(*it);
+      }
+    }
+    return true;
+  case ORDERED:
+    // waits-for edges always point from younger to older txns
+    return true;
+  case DETECT:
+    for (auto it = blockers.begin(); it != blockers.end(); ++it)
+    {
+      waits_for_[txn][*it]++;
     }
     return true;
   }
-  if (this->Status(key, new vector<Txn *>) != EXCLUSIVE || it->second->empty())
+  return true;
+}
+
+void LockManagerA::Abort(Txn *victim)
+{
+  if (!aborted_txns_.insert(victim).second)
   {
-    LockRequest new_lock_request = LockRequest(SHARED, txn);
+    return;
+  }
+  abort_count_++;
+  auto it = txn_waits_.find(victim);
+  if (it != txn_waits_.end() && acquiring_txns_.count(victim) == 0)
+  {
+    // parked: nobody else would ever wake it up
+    txn_waits_.erase(it);
+    ready_txns_->Push(victim);
+  }
+}
 
-    it->second->push_front(new_lock_request);
-    if (waiting_tx_it != txn_waits_.end()) // delete from waiting tx
+void LockManagerA::DetectDeadlock(Txn *txn)
+{
+  // the new edges may close several cycles, and the victim of one of them
+  // need not lie on the others, so keep breaking cycles until none is left
+  while (aborted_txns_.count(txn) == 0)
+  {
+    unordered_set<Txn *> visited;
+    vector<Txn *> cycle;
+    if (!FindCycle(txn, txn, &visited, &cycle))
     {
-      txn_waits_.erase(waiting_tx_it);
+      return;
+    }
+    Txn *victim = txn;
+    for (auto it = cycle.begin(); it != cycle.end(); ++it)
+    {
+      if ((*it)->unique_id_ > victim->unique_id_)
+      {
+        victim = *it;
+      }
+    }
+    Abort(victim);
+  }
+}
+
+bool LockManagerA::FindCycle(Txn *from, Txn *target,
+                             unordered_set<Txn *> *visited, vector<Txn *> *path)
+{
+  auto edges = waits_for_.find(from);
+  if (edges == waits_for_.end())
+  {
+    return false;
+  }
+  for (auto it = edges->second.begin(); it != edges->second.end(); ++it)
+  {
+    Txn *next = it->first;
+    // aborted txns are about to cancel their requests, so edges through them
+    // do not lead to a deadlock
+    if (aborted_txns_.count(next) > 0)
+    {
+      continue;
+    }
+    if (next == target)
+    {
+      path->push_back(from);
+      return true;
+    }
+    if (visited->insert(next).second && FindCycle(next, target, visited, path))
+    {
+      path->push_back(from);
+      return true;
     }
-    return true;
   }
   return false;
 }
 
-void LockManagerA::Release(Txn *txn, const Key &key)
+void LockManagerA::RemoveEdge(Txn *waiter, Txn *holder)
 {
-  auto it = lock_table_.find(key);
-  if (it != lock_table_.end())
+  auto edges = waits_for_.find(waiter);
+  if (edges == waits_for_.end())
+  {
+    return;
+  }
+  auto it = edges->second.find(holder);
+  if (it != edges->second.end() && --it->second == 0)
   {
-    deque<LockRequest> *lock_requests = it->second;
-    for (auto req_it = lock_requests->begin(); req_it != lock_requests->end();)
+    edges->second.erase(it);
+    if (edges->second.empty())
     {
-      if (req_it->txn_ == txn)
-      {
+      waits_for_.erase(edges);
+    }
+  }
+}
+
+void LockManagerA::BeginAcquire(Txn *txn)
+{
+  waits_latch_.Lock();
+  aborted_txns_.erase(txn);
+  acquiring_txns_.insert(txn);
+  txn_waits_[txn] = 1;
+  waits_latch_.Unlock();
+}
+
+bool LockManagerA::EndAcquire(Txn *txn)
+{
+  waits_latch_.Lock();
+  acquiring_txns_.erase(txn);
+  auto it = txn_waits_.find(txn);
+  bool ready = aborted_txns_.count(txn) > 0 || --it->second == 0;
+  if (ready)
+  {
+    txn_waits_.erase(it);
+  }
+  waits_latch_.Unlock();
+  return ready;
+}
 
-        if (req_it != lock_requests->begin())
+bool LockManagerA::Aborted(Txn *txn)
+{
+  waits_latch_.Lock();
+  bool aborted = aborted_txns_.count(txn) > 0;
+  waits_latch_.Unlock();
+  return aborted;
+}
+
+void LockManagerA::GrantRequests(LockQueue *lock_requests,
+                                 vector<Txn *> *granted)
+{
+  // number of requests ahead in each mode
+  int ahead[6] = {0, 0, 0, 0, 0, 0};
+  for (LockRequest *it = lock_requests->head_; it != NULL; it = it->next_)
+  {
+    if (!it->granted_)
+    {
+      bool compatible = true;
+      for (int mode = SHARED; mode <= SHARED_INTENTION_EXCLUSIVE; mode++)
+      {
+        if (ahead[mode] > 0 && !Compatible(static_cast<LockMode>(mode), it->mode_))
         {
-          auto waiting_tx_it = txn_waits_.find(txn);
-          if (waiting_tx_it != txn_waits_.end())
-          {
-            txn_waits_.erase(waiting_tx_it);
-          }
+          compatible = false;
+          break;
         }
-        lock_requests->erase(req_it);
       }
-      else
+      if (compatible)
       {
-        ++req_it;
+        it->granted_ = true;
+        granted->push_back(it->txn_);
       }
     }
+    // nothing behind an exclusive request can be granted
+    if (it->mode_ == EXCLUSIVE)
+    {
+      return;
+    }
+    ahead[it->mode_]++;
   }
-  // Implement this method!
 }
 
-LockMode LockManagerA::Status(const Key &key, vector<Txn *> *owners)
+void LockManagerA::Release(Txn *txn, const Key &key)
 {
-  owners->clear();
-  auto it = lock_table_.find(key);
-  if (it != lock_table_.end())
+  // a txn only holds a handful of locks, so finding the request through the
+  // txn is cheaper than searching the queue of 'key'
+  LockRequest **link = &txn->lock_requests_;
+  while (*link != NULL && (*link)->key_ != key)
+  {
+    link = &(*link)->txn_next_;
+  }
+  if (*link == NULL)
+  {
+    return;
+  }
+  LockRequest *request = *link;
+  *link = request->txn_next_;
+  Dequeue(request);
+}
+
+void LockManagerA::ReleaseAll(Txn *txn)
+{
+  while (txn->lock_requests_ != NULL)
+  {
+    LockRequest *request = txn->lock_requests_;
+    txn->lock_requests_ = request->txn_next_;
+    Dequeue(request);
+  }
+}
+
+void LockManagerA::ReleaseShared(Txn *txn)
+{
+  LockRequest **link = &txn->lock_requests_;
+  while (*link != NULL)
+  {
+    LockRequest *request = *link;
+    if (request->mode_ == SHARED)
+    {
+      *link = request->txn_next_;
+      Dequeue(request);
+    }
+    else
+    {
+      link = &request->txn_next_;
+    }
+  }
+}
+
+void LockManagerA::Dequeue(LockRequest *request)
+{
+  Txn *txn = request->txn_;
+  LockTableShard *shard = Shard(request->key_);
+  shard->latch_.Lock();
+  LockQueue *lock_requests = request->queue_;
+  bool was_granted = request->granted_;
+  LockMode mode = request->mode_;
+
+  // wait-for edges that go away with this request: its own edges to the
+  // incompatible requests ahead of it, if it was still waiting, and the edges
+  // of waiting requests behind it that it was blocking
+  vector<Txn *> holders;
+  vector<Txn *> waiters;
+  if (policy_ == DETECT)
+  {
+    for (LockRequest *ahead = request->prev_; !was_granted && ahead != NULL;
+         ahead = ahead->prev_)
+    {
+      if (!Compatible(mode, ahead->mode_))
+      {
+        holders.push_back(ahead->txn_);
+      }
+    }
+    for (LockRequest *behind = request->next_; behind != NULL;
+         behind = behind->next_)
+    {
+      if (!behind->granted_ && !Compatible(mode, behind->mode_))
+      {
+        waiters.push_back(behind->txn_);
+      }
+    }
+  }
+
+  // unlink the request and put it on the free list
+  if (request->prev_ != NULL)
+  {
+    request->prev_->next_ = request->next_;
+  }
+  else
+  {
+    lock_requests->head_ = request->next_;
+  }
+  if (request->next_ != NULL)
+  {
+    request->next_->prev_ = request->prev_;
+  }
+  else
+  {
+    lock_requests->tail_ = request->prev_;
+  }
+  Key key = request->key_;
+  request->next_ = shard->free_requests_;
+  shard->free_requests_ = request;
+
+  vector<Txn *> granted;
+  if (lock_requests->head_ == NULL)
   {
-    deque<LockRequest> *lock_requests = it->second;
-    if (it->second->empty())
+    // recycle the queue, so that the table only holds keys that are locked
+    shard->lock_table_.erase(key);
+    lock_requests->next_free_ = shard->free_queues_;
+    shard->free_queues_ = lock_requests;
+  }
+  else
+  {
+    GrantRequests(lock_requests, &granted);
+  }
+
+  if (!was_granted || !granted.empty() || !waiters.empty())
+  {
+    waits_latch_.Lock();
+    for (auto holder = holders.begin(); holder != holders.end(); ++holder)
+    {
+      RemoveEdge(txn, *holder);
+    }
+    for (auto waiter = waiters.begin(); waiter != waiters.end(); ++waiter)
     {
-      return UNLOCKED;
+      RemoveEdge(*waiter, txn);
     }
-    LockMode mode;
-    bool foundExclusive = false;
-    for (auto lock_it = lock_requests->begin(); lock_it != lock_requests->end(); lock_it++)
+    if (!was_granted)
     {
-      if (lock_it->mode_ == EXCLUSIVE)
-      // we dont cound exclusive locks if it s not the first one in the queue
+      // cancelled a pending request
+      auto waits_it = txn_waits_.find(txn);
+      if (waits_it != txn_waits_.end() && --waits_it->second == 0)
       {
-        foundExclusive = true;
+        txn_waits_.erase(waits_it);
       }
-      else
+    }
+    for (auto granted_it = granted.begin(); granted_it != granted.end(); ++granted_it)
+    {
+      // txns that are not tracked were aborted and are cancelling their
+      // requests, so they must not be scheduled
+      auto waits_it = txn_waits_.find(*granted_it);
+      if (waits_it != txn_waits_.end() && --waits_it->second == 0)
+      {
+        txn_waits_.erase(waits_it);
+        ready_txns_->Push(*granted_it);
+      }
+    }
+    waits_latch_.Unlock();
+  }
+  shard->latch_.Unlock();
+}
+
+LockMode LockManagerA::Status(const Key &key, vector<Txn *> *owners)
+{
+  owners->clear();
+  LockTableShard *shard = Shard(key);
+  shard->latch_.Lock();
+  LockMode mode = UNLOCKED;
+  auto it = shard->lock_table_.find(key);
+  if (it != shard->lock_table_.end())
+  {
+    // owners are the granted requests: either a single exclusive request, or
+    // a set of mutually compatible ones (with S and X only, that is the run of
+    // shared requests at the front)
+    LockQueue *lock_requests = it->second;
+    mode = lock_requests->head_->mode_;
+    for (LockRequest *lock_it = lock_requests->head_; lock_it != NULL;
+         lock_it = lock_it->next_)
+    {
+      if (lock_it->granted_)
       {
-        mode = lock_it->mode_;
         owners->push_back(lock_it->txn_);
       }
     }
-    if (foundExclusive && owners->empty())
+  }
+  shard->latch_.Unlock();
+  return mode;
+}
+
+LockManagerB::LockManagerB(AtomicQueue<Txn *> *ready_txns, Storage *storage)
+    : storage_(storage), head_(NULL), tail_(NULL)
+{
+  ready_txns_ = ready_txns;
+  abort_count_ = 0;
+}
+
+bool LockManagerB::WriteLock(Txn *txn, const Key &key)
+{
+  // only the sequencer adds to the counters, while workers may be taking
+  // theirs away, so a count can only be too high, which merely blocks the txn
+  Record *record = storage_->GetRecord(key);
+  bool granted = __sync_add_and_fetch(&record->cx_, 1) == 1 && record->cs_ == 0;
+  if (!granted)
+  {
+    txn->vll_blocked_ = true;
+  }
+  return granted;
+}
+
+bool LockManagerB::ReadLock(Txn *txn, const Key &key)
+{
+  Record *record = storage_->GetRecord(key);
+  __sync_fetch_and_add(&record->cs_, 1);
+  bool granted = record->cx_ == 0;
+  if (!granted)
+  {
+    txn->vll_blocked_ = true;
+  }
+  return granted;
+}
+
+bool LockManagerB::GranuleLock(Txn *txn, const Key &key, LockMode mode)
+{
+  DIE("VLL does not support granule locks.");
+}
+
+bool LockManagerB::AcquireAll(Txn *txn, const set<Key> &readset,
+                              const set<Key> &writeset,
+                              const map<Key, LockMode> &granules)
+{
+  // VLL orders txns by when they request their locks, not by keys
+  DIE("VLL txns must request their locks between BeginAcquire() and EndAcquire().");
+}
+
+void LockManagerB::BeginAcquire(Txn *txn)
+{
+  txn->vll_blocked_ = false;
+}
+
+bool LockManagerB::EndAcquire(Txn *txn)
+{
+  latch_.Lock();
+  txn->vll_prev_ = tail_;
+  txn->vll_next_ = NULL;
+  if (tail_ != NULL)
+  {
+    tail_->vll_next_ = txn;
+  }
+  else
+  {
+    head_ = txn;
+  }
+  tail_ = txn;
+
+  // nothing is ahead of the front txn, whatever its counters say
+  if (head_ == txn)
+  {
+    txn->vll_blocked_ = false;
+  }
+  bool ready = !txn->vll_blocked_;
+  latch_.Unlock();
+  return ready;
+}
+
+void LockManagerB::Release(Txn *txn, const Key &key)
+{
+  Record *record = storage_->GetRecord(key);
+  if (txn->writeset_.count(key) > 0)
+  {
+    __sync_fetch_and_sub(&record->cx_, 1);
+  }
+  else
+  {
+    __sync_fetch_and_sub(&record->cs_, 1);
+  }
+}
+
+void LockManagerB::ReleaseAll(Txn *txn)
+{
+  for (set<Key>::iterator it = txn->readset_.begin();
+       it != txn->readset_.end(); ++it)
+  {
+    __sync_fetch_and_sub(&storage_->GetRecord(*it)->cs_, 1);
+  }
+  for (set<Key>::iterator it = txn->writeset_.begin();
+       it != txn->writeset_.end(); ++it)
+  {
+    __sync_fetch_and_sub(&storage_->GetRecord(*it)->cx_, 1);
+  }
+
+  // the txns behind this one only rely on its place in the queue, so the
+  // counters need not change together with it
+  latch_.Lock();
+  if (txn->vll_prev_ != NULL)
+  {
+    txn->vll_prev_->vll_next_ = txn->vll_next_;
+  }
+  else
+  {
+    head_ = txn->vll_next_;
+  }
+  if (txn->vll_next_ != NULL)
+  {
+    txn->vll_next_->vll_prev_ = txn->vll_prev_;
+  }
+  else
+  {
+    tail_ = txn->vll_prev_;
+  }
+  txn->vll_prev_ = NULL;
+  txn->vll_next_ = NULL;
+
+  // a blocked txn that reaches the front has all of its locks
+  if (head_ != NULL && head_->vll_blocked_)
+  {
+    head_->vll_blocked_ = false;
+    ready_txns_->Push(head_);
+  }
+  latch_.Unlock();
+}
+
+void LockManagerB::ReleaseShared(Txn *txn)
+{
+  // a txn only leaves the queue with all of its locks
+  DIE("VLL txns can only release their locks through ReleaseAll().");
+}
+
+LockMode LockManagerB::Status(const Key &key, vector<Txn *> *owners)
+{
+  owners->clear();
+  latch_.Lock();
+  // the requests for 'key' are those of the queued txns that use it, in queue
+  // order, so the owners are the granted prefix of them just as in LockManagerA
+  LockMode mode = UNLOCKED;
+  for (Txn *txn = head_; txn != NULL; txn = txn->vll_next_)
+  {
+    LockMode request = txn->writeset_.count(key) > 0  ? EXCLUSIVE
+                       : txn->readset_.count(key) > 0 ? SHARED
+                                                      : UNLOCKED;
+    if (request == UNLOCKED)
+    {
+      continue;
+    }
+    if (mode == UNLOCKED)
+    {
+      mode = request;
+    }
+    else if (mode == EXCLUSIVE || request == EXCLUSIVE)
     {
-      owners->push_back(lock_requests->begin()->txn_);
-      mode = EXCLUSIVE;
+      break;
     }
-    return mode;
+    owners->push_back(txn);
   }
-  // Implement this method!
-  return UNLOCKED;
-}
\ No newline at end of file
+  latch_.Unlock();
+  return mode;
+}
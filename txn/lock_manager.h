@@ -5,26 +5,80 @@
 #define _LOCK_MANAGER_H_
 
 #include <tr1/unordered_map>
-#include <deque>
+#include <tr1/unordered_set>
 #include <map>
+#include <set>
 #include <vector>
 
 #include "common.h"
+#include "utils/atomic.h"
+#include "utils/mutex.h"
 
 using std::map;
-using std::deque;
+using std::set;
 using std::vector;
 using std::tr1::unordered_map;
+using std::tr1::unordered_set;
 
 class Txn;
+class Storage;
+
+// Number of partitions of the lock table. Each partition has its own latch, so
+// lock requests on keys that hash to different partitions proceed in parallel.
+#define LOCK_TABLE_SHARDS 64
+
+// Number of consecutive keys that make up a granule, the coarse level of the
+// lock hierarchy.
+#define LOCK_GRANULE_SIZE 4096
 
 // This interface supports locks being held in both read/shared and
-// write/exclusive modes.
+// write/exclusive modes. Granules can additionally be locked in the intention
+// modes, which announce shared or exclusive locks on keys inside the granule.
 enum LockMode
 {
   UNLOCKED = 0,
   SHARED = 1,
   EXCLUSIVE = 2,
+  INTENTION_SHARED = 3,           // IS: some keys of the granule will be read.
+  INTENTION_EXCLUSIVE = 4,        // IX: some keys of the granule will be written.
+  SHARED_INTENTION_EXCLUSIVE = 5, // SIX: S on the granule, plus IX.
+};
+
+struct LockQueue;
+
+// A request by a txn for a lock on a key. Each request is linked both into the
+// request queue of its key and into the list of requests of its txn, so that a
+// txn can release its locks without looking its keys up in the lock table.
+struct LockRequest
+{
+  Txn *txn_;              // Pointer to txn requesting the lock.
+  LockMode mode_;         // Specifies whether this is a read or write lock request.
+  bool granted_;          // True once the request has been granted.
+  Key key_;               // Key the lock is requested on.
+  LockQueue *queue_;      // Request queue of 'key_'.
+  LockRequest *prev_;     // Previous request in 'queue_'.
+  LockRequest *next_;     // Next request in 'queue_', or next free request.
+  LockRequest *txn_next_; // Next request of 'txn_'.
+};
+
+// Request queue of a single key, oldest request first.
+struct LockQueue
+{
+  LockRequest *head_;    // Oldest request.
+  LockRequest *tail_;    // Newest request.
+  LockQueue *next_free_; // Next free queue, while the queue is unused.
+};
+
+// Strategies a LockManager can use to keep blocked txns from deadlocking.
+enum DeadlockPolicy
+{
+  WAIT_DIE = 0,   // A txn that would wait for an older txn aborts instead.
+  WOUND_WAIT = 1, // An older txn aborts younger not-yet-running txns in its way.
+  DETECT = 2,     // Txns wait freely. Whenever a txn blocks, the wait-for graph
+                  // is checked, and the youngest txn of any cycle aborts.
+  ORDERED = 3,    // Txns always wait. Only safe when every txn requests all of
+                  // its locks before any later txn requests one of its own, or
+                  // when all txns use AcquireAll().
 };
 
 class LockManager
@@ -34,7 +88,8 @@ public:
 
   // Attempts to grant a read lock to the specified transaction, enqueueing
   // request in lock table. Returns true if lock is immediately granted, else
-  // returns false.
+  // returns false. A request that is not granted stays queued and is counted
+  // in 'txn_waits_' until a later Release() grants it.
   //
   // Requires: Neither ReadLock nor WriteLock has previously been called with
   //           this txn and key.
@@ -42,43 +97,100 @@ public:
 
   // Attempts to grant a write lock to the specified transaction, enqueueing
   // request in lock table. Returns true if lock is immediately granted, else
-  // returns false.
+  // returns false. A request that is not granted stays queued and is counted
+  // in 'txn_waits_' until a later Release() grants it.
   //
   // Requires: Neither ReadLock nor WriteLock has previously been called with
   //           this txn and key.
   virtual bool WriteLock(Txn *txn, const Key &key) = 0;
 
+  // Attempts to grant a lock in 'mode' on the granule containing 'key' to the
+  // specified transaction, like ReadLock() and WriteLock() do for single keys.
+  // A SHARED or EXCLUSIVE granule lock covers every key in the granule. Txns
+  // that lock single keys must also lock their granules in an intention mode
+  // (or SHARED_INTENTION_EXCLUSIVE) first, so that both kinds of locks
+  // conflict as they should.
+  //
+  // Requires: GranuleLock has not previously been called with this txn and
+  //           any key of the same granule.
+  virtual bool GranuleLock(Txn *txn, const Key &key, LockMode mode) = 0;
+
+  // Requests SHARED locks on 'readset' and EXCLUSIVE locks on 'writeset' for
+  // 'txn', along with a lock in the mode 'granules' maps each key to on the
+  // granule containing that key (as GranuleLock() would), in a single global
+  // order: by lock table shard, then by key. All requests that fall into the
+  // same shard are made under one latch hold.
+  //
+  // Returns true once 'txn' holds all of these locks. Otherwise, the first
+  // request that cannot be granted stays queued and no later requests are
+  // made; once it is granted, 'txn' is appended to 'ready_txns_', and the
+  // caller continues by calling AcquireAll() again with the same sets.
+  //
+  // A txn only ever waits for a lock that comes after all the locks it holds
+  // in the global order, so txns that acquire their locks this way can never
+  // deadlock, and are never aborted.
+  //
+  // Requires: The txn makes no other lock requests, and is not mixed with txns
+  //           using other requests under a policy other than ORDERED.
+  virtual bool AcquireAll(Txn *txn, const set<Key> &readset,
+                          const set<Key> &writeset,
+                          const map<Key, LockMode> &granules) = 0;
+
+  // Starts the lock request phase of 'txn'. Until EndAcquire(txn) is called,
+  // 'txn' is never appended to 'ready_txns_', even if every lock it has
+  // requested so far has been granted. This keeps a txn whose requests are
+  // granted by concurrent Release() calls from being scheduled twice.
+  virtual void BeginAcquire(Txn *txn) = 0;
+
+  // Ends the lock request phase of 'txn'. Returns true if 'txn' can be handled
+  // right away, either because all of its locks have been granted or because
+  // it has been aborted (see Aborted()). Otherwise returns false, and 'txn' is
+  // appended to 'ready_txns_' by the Release() that grants its last pending
+  // request.
+  virtual bool EndAcquire(Txn *txn) = 0;
+
+  // Returns true if 'txn' was aborted by the lock manager to prevent a
+  // deadlock during its last lock request phase. An aborted txn must Release()
+  // all of its keys (cancelling any pending requests) and then start over.
+  virtual bool Aborted(Txn *txn) = 0;
+
   // Releases lock held by 'txn' on 'key', or cancels any pending request for
   // a lock on 'key' by 'txn'. If 'txn' held an EXCLUSIVE lock on 'key' (or was
   // the sole holder of a SHARED lock on 'key'), then the next request(s) in the
   // request queue is granted. If the granted request(s) corresponds to a
   // transaction that has now acquired ALL of its locks, that transaction is
   // appended to the 'ready_txns_' queue.
-  //
-  // CPSC 438/538:
-  // IMPORTANT NOTE: In order to know WHEN a transaction is ready to run, you
-  // may need to track its lock acquisition progress during the lock request
-  // process.
-  // (Hint: Use 'LockManager::txn_waits_' defined below.)
   virtual void Release(Txn *txn, const Key &key) = 0;
 
+  // Same as calling Release() for every key 'txn' has requested a lock on,
+  // but takes constant time per lock.
+  virtual void ReleaseAll(Txn *txn) = 0;
+
+  // Same as calling Release() for every key 'txn' holds a SHARED lock on, in
+  // a single pass over its requests. Used to drop read locks once a txn has
+  // done all of its reads.
+  virtual void ReleaseShared(Txn *txn) = 0;
+
   // Sets '*owners' to contain the txn IDs of all txns holding the lock, and
   // returns the current LockMode of the lock: UNLOCKED if it is not currently
   // held, SHARED or EXCLUSIVE if it is, depending on the current state.
   virtual LockMode Status(const Key &key, vector<Txn *> *owners) = 0;
 
+  // Returns the number of times a txn has been aborted to prevent deadlock.
+  int AbortCount() { return abort_count_; }
+
 protected:
   // The LockManager's lock table tracks all lock requests. For a given key, if
-  // 'lock_table_' contains a nonempty deque, then the item with that key is
-  // locked and either:
+  // 'lock_table_' contains a queue, then the item with that key is locked and
+  // either:
   //
-  //  (a) first element in the deque specifies the owner if that item is a
+  //  (a) first element in the queue specifies the owner if that item is a
   //      request for an EXCLUSIVE lock, or
   //
   //  (b) a SHARED lock is held by all elements of the longest prefix of the
-  //      deque containing only SHARED lock requests.
+  //      queue containing only SHARED lock requests.
   //
-  // For example, if lock_table_["key1"] points to a deque containing
+  // For example, if lock_table_["key1"] points to a queue containing
   //
   //    (&Txn1, SHARED), (&Txn2, SHARED), (&Txn3, EXCLUSIVE), (&Txn4, SHARED)
   //
@@ -88,42 +200,201 @@ protected:
   // cannot acquire a lock until after Txn3 has released its lock, so it cannot
   // share the lock with Txn1 and Txn2.)
   //
-  // As a second example, if lock_table_["key1"] points to a deque containing
+  // As a second example, if lock_table_["key1"] points to a queue containing
   //
   //    (&Txn1, EXCLUSIVE), (&Txn2, SHARED), (&Txn3, SHARED), (Txn4, EXCLUSIVE)
   //
   // then Txn1 currently holds an EXCLUSIVE lock on "key1". When Txn1 releases
   // its lock, Txn2 and Txn3 will simultaneously acquire SHARED locks on "key1".
-  struct LockRequest
+  //
+  // A queue is removed from the table as soon as its last request is released.
+  //
+  // The lock table is partitioned into LOCK_TABLE_SHARDS shards by key hash.
+  // A shard's 'latch_' must be held while reading or modifying its
+  // 'lock_table_', any request queue stored in it, or its free lists. Requests
+  // and queues that are no longer used go to the free lists of their shard and
+  // are reused from there, instead of being returned to the heap.
+  struct LockTableShard
   {
-    LockRequest(LockMode m, Txn *t) : txn_(t), mode_(m) {}
-    Txn *txn_;      // Pointer to txn requesting the lock.
-    LockMode mode_; // Specifies whether this is a read or write lock request.
+    LockTableShard() : free_requests_(NULL), free_queues_(NULL) {}
+    Mutex latch_;
+    unordered_map<Key, LockQueue *> lock_table_;
+    LockRequest *free_requests_;
+    LockQueue *free_queues_;
   };
-  unordered_map<Key, deque<LockRequest>*> lock_table_;
+  LockTableShard shards_[LOCK_TABLE_SHARDS];
+
+  // Returns true if a lock in mode 'a' and a lock in mode 'b' on the same key
+  // can be held at the same time.
+  static bool Compatible(LockMode a, LockMode b);
+
+  // Returns the shard responsible for 'key'.
+  LockTableShard *Shard(const Key &key)
+  {
+    // Fibonacci hashing, so that strided key patterns still spread evenly.
+    return &shards_[((key * 0x9E3779B97F4A7C15ULL) >> 32) % LOCK_TABLE_SHARDS];
+  }
 
   // Queue of pointers to transactions that:
   //  (a) were previously blocked on acquiring at least one lock, and
   //  (b) have now acquired all locks that they have requested.
-  deque<Txn *> *ready_txns_;
+  //
+  // Appended to by whichever thread calls Release(), so it must be atomic.
+  AtomicQueue<Txn *> *ready_txns_;
 
-  // Tracks all txns still waiting on acquiring at least one lock. Entries in
-  // 'txn_waits_' are invalided by any call to Release() with the entry's
-  // txn.
+  // Tracks all txns still waiting on acquiring at least one lock, mapped to
+  // the number of their requests that have not been granted yet. While a txn
+  // is between BeginAcquire() and EndAcquire(), its count is one higher, so it
+  // cannot reach zero before the txn has issued all of its requests.
   unordered_map<Txn*, int> txn_waits_;
+
+  // Txns that were aborted during their current lock request phase.
+  unordered_set<Txn*> aborted_txns_;
+
+  // Txns that are between BeginAcquire() and EndAcquire(). A txn that has an
+  // entry in 'txn_waits_' but is not in this set is parked.
+  unordered_set<Txn*> acquiring_txns_;
+
+  // Number of txns aborted to prevent deadlock.
+  int abort_count_;
+
+  // Guards 'txn_waits_', 'aborted_txns_', 'acquiring_txns_' and
+  // 'abort_count_'. When both are needed, a shard latch is always acquired
+  // before 'waits_latch_'.
+  Mutex waits_latch_;
 };
 
 // Version of the LockManager implementing both shared and exclusive locks (2PL).
 class LockManagerA : public LockManager
 {
 public:
-  explicit LockManagerA(deque<Txn *> *ready_txns);
-  inline virtual ~LockManagerA() {}
+  explicit LockManagerA(AtomicQueue<Txn *> *ready_txns,
+                        DeadlockPolicy policy = WAIT_DIE);
+  virtual ~LockManagerA();
 
   virtual bool ReadLock(Txn *txn, const Key &key);
   virtual bool WriteLock(Txn *txn, const Key &key);
+  virtual bool GranuleLock(Txn *txn, const Key &key, LockMode mode);
+  virtual bool AcquireAll(Txn *txn, const set<Key> &readset,
+                          const set<Key> &writeset,
+                          const map<Key, LockMode> &granules);
+  virtual void BeginAcquire(Txn *txn);
+  virtual bool EndAcquire(Txn *txn);
+  virtual bool Aborted(Txn *txn);
   virtual void Release(Txn *txn, const Key &key);
+  virtual void ReleaseAll(Txn *txn);
+  virtual void ReleaseShared(Txn *txn);
   virtual LockMode Status(const Key &key, vector<Txn *> *owners);
+
+private:
+  // Returns the request queue for 'key', creating an empty one if none exists.
+  //
+  // Requires: The latch of 'shard' (which must be Shard(key)) is held.
+  LockQueue *Requests(LockTableShard *shard, const Key &key);
+
+  // Enqueues a request by 'txn' for a lock on 'key' in 'mode'. Shared by
+  // ReadLock() and WriteLock().
+  bool Request(Txn *txn, const Key &key, LockMode mode);
+
+  // Appends a new request by 'txn' for a lock on 'key' in 'mode' to
+  // 'lock_requests', the queue of 'key', and to the requests of 'txn'.
+  //
+  // Requires: The latch of 'shard' (which must be Shard(key)) is held.
+  void Enqueue(LockTableShard *shard, LockQueue *lock_requests, Txn *txn,
+               const Key &key, LockMode mode, bool granted);
+
+  // Removes 'request' from its queue and frees it, granting the requests
+  // behind it that become compatible. 'request' must already have been
+  // unlinked from the requests of its txn.
+  void Dequeue(LockRequest *request);
+
+  // Marks every request in 'lock_requests' that has become compatible with
+  // all requests ahead of it as granted, and appends the owners of those
+  // requests to '*granted'.
+  //
+  // Note that with intention modes, a request may be granted while a request
+  // ahead of it still waits, as long as the two are compatible.
+  void GrantRequests(LockQueue *lock_requests, vector<Txn *> *granted);
+
+  // Applies 'policy_' to 'txn', which is about to wait for the requests of
+  // 'blockers'. Returns false if 'txn' must abort instead of waiting.
+  //
+  // Requires: 'waits_latch_' is held.
+  bool MayWait(Txn *txn, const vector<Txn *> &blockers);
+
+  // Aborts 'victim'. If it is parked, it is handed to 'ready_txns_' so that
+  // its owner can roll it back.
+  //
+  // Requires: 'waits_latch_' is held.
+  void Abort(Txn *victim);
+
+  // Breaks every cycle through 'txn' in 'waits_for_' by aborting the youngest
+  // member of each.
+  //
+  // Requires: 'waits_latch_' is held.
+  void DetectDeadlock(Txn *txn);
+
+  // Appends to '*path' a path of live txns in 'waits_for_' that leads from
+  // 'from' back to 'target', returning false if there is none.
+  bool FindCycle(Txn *from, Txn *target, unordered_set<Txn *> *visited,
+                 vector<Txn *> *path);
+
+  // Removes one 'waiter' -> 'holder' edge from 'waits_for_'.
+  //
+  // Requires: 'waits_latch_' is held.
+  void RemoveEdge(Txn *waiter, Txn *holder);
+
+  DeadlockPolicy policy_;
+
+  // Wait-for graph, only maintained under the DETECT policy. Maps each waiting
+  // txn to the txns it waits for, counting one edge per key the wait is on.
+  // Guarded by 'waits_latch_'.
+  unordered_map<Txn *, map<Txn *, int> > waits_for_;
+};
+
+// Version of the LockManager implementing Very Lightweight Locking (VLL).
+// Instead of request queues, every record in 'storage' counts the txns that
+// hold or wait for a lock on it, and a single queue orders all txns that hold
+// or wait for locks by request time. A txn whose counters show that it is the
+// only one using each of its keys gets its locks right away. Any other txn is
+// blocked until every txn ahead of it in the queue has released its locks.
+//
+// Txns must request their locks one txn at a time, in the order they should be
+// serialized in, and never deadlock or get aborted. A txn only leaves the queue
+// through ReleaseAll(), so it must not also Release() any of its keys.
+class LockManagerB : public LockManager
+{
+public:
+  LockManagerB(AtomicQueue<Txn *> *ready_txns, Storage *storage);
+  virtual ~LockManagerB() {}
+
+  virtual bool ReadLock(Txn *txn, const Key &key);
+  virtual bool WriteLock(Txn *txn, const Key &key);
+  virtual bool GranuleLock(Txn *txn, const Key &key, LockMode mode);
+  virtual bool AcquireAll(Txn *txn, const set<Key> &readset,
+                          const set<Key> &writeset,
+                          const map<Key, LockMode> &granules);
+  virtual void BeginAcquire(Txn *txn);
+  virtual bool EndAcquire(Txn *txn);
+  virtual bool Aborted(Txn *txn) { return false; }
+  virtual void Release(Txn *txn, const Key &key);
+  virtual void ReleaseAll(Txn *txn);
+  virtual void ReleaseShared(Txn *txn);
+  virtual LockMode Status(const Key &key, vector<Txn *> *owners);
+
+private:
+  // Records whose counters are used as locks.
+  Storage *storage_;
+
+  // Oldest and newest txn in the txn queue, linked through their 'vll_prev_'
+  // and 'vll_next_' fields.
+  Txn *head_;
+  Txn *tail_;
+
+  // Guards the txn queue. The counters of the records are updated with
+  // atomic instructions instead, so locking and releasing keys only touches
+  // the records themselves.
+  Mutex latch_;
 };
 
 #endif // _LOCK_MANAGER_H_
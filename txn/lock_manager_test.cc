@@ -3,66 +3,571 @@
 #include <set>
 #include <string>
 
+#include "txn/storage.h"
+#include "txn/txn_types.h"
 #include "utils/testing.h"
 
 using std::set;
 
+// Noop with a given unique_id_, which the deadlock policies use as its age.
+class AgedNoop : public Noop
+{
+public:
+  explicit AgedNoop(uint64 unique_id) { unique_id_ = unique_id; }
+};
+
 TEST(LockManagerA_SimpleLocking)
 {
-  deque<Txn *> ready_txns;
+  AtomicQueue<Txn *> ready_txns;
   LockManagerA lm(&ready_txns);
   vector<Txn *> owners;
+  Txn *ready;
 
-  Txn *t1 = reinterpret_cast<Txn *>(1);
-  Txn *t2 = reinterpret_cast<Txn *>(2);
-  Txn *t3 = reinterpret_cast<Txn *>(3);
+  Txn *t1 = new Noop();
+  Txn *t2 = new Noop();
+  Txn *t3 = new Noop();
 
   // Txn 1 acquires read lock.
-  lm.ReadLock(t1, 101);
-  ready_txns.push_back(t1); // Txn 1 is ready.
+  EXPECT_TRUE(lm.ReadLock(t1, 101));
   EXPECT_EQ(SHARED, lm.Status(101, &owners));
   EXPECT_EQ(1, owners.size());
   EXPECT_EQ(t1, owners[0]);
-  EXPECT_EQ(1, ready_txns.size());
-  EXPECT_EQ(t1, ready_txns.at(0));
+  EXPECT_EQ(0, ready_txns.Size());
 
   // Txn 2 requests write lock. Not granted.
-  lm.WriteLock(t2, 101);
+  EXPECT_FALSE(lm.WriteLock(t2, 101));
   EXPECT_EQ(SHARED, lm.Status(101, &owners));
   EXPECT_EQ(1, owners.size());
   EXPECT_EQ(t1, owners[0]);
-  EXPECT_EQ(1, ready_txns.size());
+  EXPECT_EQ(0, ready_txns.Size());
 
-  // Txn 3 requests read lock. Granted.
-  lm.ReadLock(t3, 101);
-  ready_txns.push_back(t3); // Txn 1 is ready.
+  // Txn 3 requests read lock. Not granted (it is queued behind txn 2).
+  EXPECT_FALSE(lm.ReadLock(t3, 101));
   EXPECT_EQ(SHARED, lm.Status(101, &owners));
-  EXPECT_EQ(2, owners.size());
-  EXPECT_EQ(t3, owners[0]);
-  EXPECT_EQ(2, ready_txns.size());
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t1, owners[0]);
+  EXPECT_EQ(0, ready_txns.Size());
 
   // Txn 1 releases lock.  Txn 2 is granted write lock.
   lm.Release(t1, 101);
-  ready_txns.pop_front();
+  EXPECT_EQ(EXCLUSIVE, lm.Status(101, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t2, owners[0]);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t2, ready);
+
+  // Txn 2 releases lock.  Txn 3 is granted read lock.
+  lm.Release(t2, 101);
   EXPECT_EQ(SHARED, lm.Status(101, &owners));
   EXPECT_EQ(1, owners.size());
   EXPECT_EQ(t3, owners[0]);
-  EXPECT_EQ(1, ready_txns.size());
-  EXPECT_EQ(t3, ready_txns.at(0));
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t3, ready);
 
   lm.Release(t3, 101);
-  ready_txns.pop_front();
   EXPECT_EQ(UNLOCKED, lm.Status(101, &owners));
   EXPECT_EQ(0, owners.size());
 
-  // Txn 2 releases lock.  Txn 3 is granted read lock.
-  lm.Release(t2, 101);
+  delete t1;
+  delete t2;
+  delete t3;
+  END;
+}
+
+TEST(LockManagerA_AcquisitionPhase)
+{
+  AtomicQueue<Txn *> ready_txns;
+  LockManagerA lm(&ready_txns);
+  Txn *ready;
+
+  Txn *t1 = new Noop();
+  Txn *t2 = new Noop();
+
+  // Txn 1 holds both keys.
+  lm.BeginAcquire(t1);
+  EXPECT_TRUE(lm.WriteLock(t1, 1));
+  EXPECT_TRUE(lm.WriteLock(t1, 2));
+  EXPECT_TRUE(lm.EndAcquire(t1));
+
+  // Txn 2 blocks on key 1. A grant that arrives before txn 2 has issued all
+  // of its requests must not make it ready.
+  lm.BeginAcquire(t2);
+  EXPECT_FALSE(lm.ReadLock(t2, 1));
+  lm.Release(t1, 1);
+  EXPECT_EQ(0, ready_txns.Size());
+  EXPECT_FALSE(lm.ReadLock(t2, 2));
+
+  // Txn 2 still waits for key 2, so it parks.
+  EXPECT_FALSE(lm.EndAcquire(t2));
+  EXPECT_EQ(0, ready_txns.Size());
+
+  // Granting its last lock makes txn 2 ready.
+  lm.Release(t1, 2);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t2, ready);
+  EXPECT_FALSE(lm.Aborted(t2));
+
+  lm.Release(t2, 1);
+  lm.Release(t2, 2);
+
+  delete t1;
+  delete t2;
+  END;
+}
+
+TEST(LockManagerA_ReleaseAll)
+{
+  AtomicQueue<Txn *> ready_txns;
+  LockManagerA lm(&ready_txns);
+  vector<Txn *> owners;
+  Txn *ready;
+
+  Txn *t1 = new Noop();
+  Txn *t2 = new Noop();
+
+  // Txn 1 holds keys 1 and 2, txn 2 waits for both of them.
+  EXPECT_TRUE(lm.WriteLock(t1, 1));
+  EXPECT_TRUE(lm.ReadLock(t1, 2));
+  lm.BeginAcquire(t2);
+  EXPECT_FALSE(lm.ReadLock(t2, 1));
+  EXPECT_FALSE(lm.WriteLock(t2, 2));
+  EXPECT_FALSE(lm.EndAcquire(t2));
+
+  // Releasing all locks of txn 1 at once makes txn 2 ready.
+  lm.ReleaseAll(t1);
+  EXPECT_EQ(SHARED, lm.Status(1, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t2, owners[0]);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(2, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t2, owners[0]);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t2, ready);
+
+  // Released requests and queues are reused.
+  lm.ReleaseAll(t2);
+  EXPECT_EQ(UNLOCKED, lm.Status(1, &owners));
+  EXPECT_EQ(UNLOCKED, lm.Status(2, &owners));
+  EXPECT_TRUE(lm.WriteLock(t1, 3));
+  EXPECT_EQ(EXCLUSIVE, lm.Status(3, &owners));
+  EXPECT_EQ(t1, owners[0]);
+  lm.Release(t1, 3);
+  EXPECT_EQ(UNLOCKED, lm.Status(3, &owners));
+
+  delete t1;
+  delete t2;
+  END;
+}
+
+TEST(LockManagerA_ReleaseShared)
+{
+  AtomicQueue<Txn *> ready_txns;
+  LockManagerA lm(&ready_txns);
+  vector<Txn *> owners;
+  Txn *ready;
+
+  Txn *t1 = new Noop();
+  Txn *t2 = new Noop();
+
+  // Txn 1 reads key 1 and writes key 2, txn 2 waits to write key 1.
+  EXPECT_TRUE(lm.ReadLock(t1, 1));
+  EXPECT_TRUE(lm.WriteLock(t1, 2));
+  EXPECT_FALSE(lm.WriteLock(t2, 1));
+
+  // Dropping the read locks of txn 1 hands key 1 to txn 2 but keeps key 2.
+  lm.ReleaseShared(t1);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(1, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t2, owners[0]);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(2, &owners));
+  EXPECT_EQ(t1, owners[0]);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t2, ready);
+
+  lm.ReleaseAll(t1);
+  lm.ReleaseAll(t2);
+  EXPECT_EQ(UNLOCKED, lm.Status(1, &owners));
+  EXPECT_EQ(UNLOCKED, lm.Status(2, &owners));
+
+  delete t1;
+  delete t2;
+  END;
+}
+
+TEST(LockManagerA_AcquireAll)
+{
+  AtomicQueue<Txn *> ready_txns;
+  LockManagerA lm(&ready_txns, ORDERED);
+  vector<Txn *> owners;
+  Txn *ready;
+
+  Txn *t1 = new Noop();
+  Txn *t2 = new Noop();
+  set<Key> none, key1, key2, keys12;
+  map<Key, LockMode> no_granules, granule0;
+  key1.insert(1);
+  key2.insert(2);
+  keys12.insert(1);
+  keys12.insert(2);
+
+  // Txn 1 writes keys 1 and 2.
+  EXPECT_TRUE(lm.AcquireAll(t1, none, keys12, no_granules));
+  EXPECT_EQ(EXCLUSIVE, lm.Status(1, &owners));
+  EXPECT_EQ(EXCLUSIVE, lm.Status(2, &owners));
+
+  // Txn 2 reads key 1 and writes key 2. It parks on whichever of them comes
+  // first, without requesting the other one.
+  EXPECT_FALSE(lm.AcquireAll(t2, key1, key2, no_granules));
+  EXPECT_EQ(0, ready_txns.Size());
+
+  // Once txn 1 is done, txn 2 resumes and gets both locks.
+  lm.ReleaseAll(t1);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t2, ready);
+  EXPECT_TRUE(lm.AcquireAll(t2, key1, key2, no_granules));
+  EXPECT_EQ(SHARED, lm.Status(1, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t2, owners[0]);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(2, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t2, owners[0]);
+
+  // Granule locks are requested in the same order. Txn 1 locks all of
+  // granule 0, so txn 2 parks before it gets the record locks it holds.
+  lm.ReleaseAll(t2);
+  granule0[0] = EXCLUSIVE;
+  EXPECT_TRUE(lm.AcquireAll(t1, none, none, granule0));
+  granule0[0] = INTENTION_EXCLUSIVE;
+  EXPECT_FALSE(lm.AcquireAll(t2, none, keys12, granule0));
+  EXPECT_EQ(0, ready_txns.Size());
+  lm.ReleaseAll(t1);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t2, ready);
+  EXPECT_TRUE(lm.AcquireAll(t2, none, keys12, granule0));
+  EXPECT_EQ(EXCLUSIVE, lm.Status(1, &owners));
+  EXPECT_EQ(t2, owners[0]);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(2, &owners));
+  EXPECT_EQ(t2, owners[0]);
+
+  lm.ReleaseAll(t2);
+  EXPECT_EQ(UNLOCKED, lm.Status(1, &owners));
+  EXPECT_EQ(UNLOCKED, lm.Status(2, &owners));
+
+  delete t1;
+  delete t2;
+  END;
+}
+
+TEST(LockManagerA_GranuleLocking)
+{
+  AtomicQueue<Txn *> ready_txns;
+  LockManagerA lm(&ready_txns);
+  vector<Txn *> owners;
+  Txn *ready;
+
+  Txn *t1 = new Noop();
+  Txn *t2 = new Noop();
+  Txn *t3 = new Noop();
+  Txn *t4 = new Noop();
+
+  // Txn 1 reads key 1 and txn 2 writes key 2, both in granule 0.
+  EXPECT_TRUE(lm.GranuleLock(t1, 1, INTENTION_SHARED));
+  EXPECT_TRUE(lm.ReadLock(t1, 1));
+  EXPECT_TRUE(lm.GranuleLock(t2, 2, INTENTION_EXCLUSIVE));
+  EXPECT_TRUE(lm.WriteLock(t2, 2));
+
+  // Txn 3 wants to read all of granule 0, which conflicts with txn 2.
+  lm.BeginAcquire(t3);
+  EXPECT_FALSE(lm.GranuleLock(t3, 3, SHARED));
+  EXPECT_FALSE(lm.EndAcquire(t3));
+
+  // Txn 4 reads key 4. Its intention lock is compatible with all requests on
+  // granule 0, so it does not queue up behind txn 3.
+  EXPECT_TRUE(lm.GranuleLock(t4, 4, INTENTION_SHARED));
+  EXPECT_TRUE(lm.ReadLock(t4, 4));
+
+  // Granule locks do not show up on the keys they cover.
+  EXPECT_EQ(SHARED, lm.Status(1, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t1, owners[0]);
+
+  // Once txn 2 is done, txn 3 gets the granule.
+  lm.ReleaseAll(t2);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t3, ready);
+
+  // A writer now has to wait for txn 3.
+  EXPECT_FALSE(lm.GranuleLock(t2, 2, INTENTION_EXCLUSIVE));
+
+  lm.ReleaseAll(t1);
+  lm.ReleaseAll(t2);
+  lm.ReleaseAll(t3);
+  lm.ReleaseAll(t4);
+  EXPECT_EQ(UNLOCKED, lm.Status(1, &owners));
+  EXPECT_EQ(UNLOCKED, lm.Status(4, &owners));
+
+  delete t1;
+  delete t2;
+  delete t3;
+  delete t4;
+  END;
+}
+
+TEST(LockManagerA_DeadlockDetection)
+{
+  AtomicQueue<Txn *> ready_txns;
+  LockManagerA lm(&ready_txns, DETECT);
+  Txn *ready;
+
+  Txn *t1 = new Noop();
+  Txn *t2 = new Noop();
+
+  // Txn 1 holds key 1 and txn 2 holds key 2.
+  lm.BeginAcquire(t1);
+  EXPECT_TRUE(lm.WriteLock(t1, 1));
+  lm.BeginAcquire(t2);
+  EXPECT_TRUE(lm.WriteLock(t2, 2));
+
+  // Txn 1 waits for txn 2, and parks.
+  EXPECT_FALSE(lm.WriteLock(t1, 2));
+  EXPECT_FALSE(lm.EndAcquire(t1));
+  EXPECT_FALSE(lm.Aborted(t1));
+
+  // Txn 2 closes the cycle and is chosen as the victim.
+  EXPECT_FALSE(lm.WriteLock(t2, 1));
+  EXPECT_TRUE(lm.Aborted(t2));
+  EXPECT_TRUE(lm.EndAcquire(t2));
+  EXPECT_EQ(1, lm.AbortCount());
+  EXPECT_EQ(0, ready_txns.Size());
+
+  // Rolling txn 2 back hands key 2 to txn 1.
+  lm.Release(t2, 2);
+  lm.Release(t2, 1);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t1, ready);
+  EXPECT_FALSE(lm.Aborted(t1));
+
+  lm.Release(t1, 1);
+  lm.Release(t1, 2);
+
+  delete t1;
+  delete t2;
+  END;
+}
+
+TEST(LockManagerA_WaitDie)
+{
+  AtomicQueue<Txn *> ready_txns;
+  LockManagerA lm(&ready_txns, WAIT_DIE);
+  vector<Txn *> owners;
+  Txn *ready;
+
+  Txn *t1 = new AgedNoop(1);
+  Txn *t2 = new AgedNoop(2);
+
+  // Txn 1 holds key 1.
+  lm.BeginAcquire(t1);
+  EXPECT_TRUE(lm.WriteLock(t1, 1));
+  EXPECT_TRUE(lm.EndAcquire(t1));
+
+  // Younger txn 2 would wait for txn 1, so it dies without queueing.
+  lm.BeginAcquire(t2);
+  EXPECT_FALSE(lm.WriteLock(t2, 1));
+  EXPECT_TRUE(lm.Aborted(t2));
+  EXPECT_TRUE(lm.EndAcquire(t2));
+  EXPECT_EQ(1, lm.AbortCount());
+  EXPECT_EQ(EXCLUSIVE, lm.Status(1, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t1, owners[0]);
+  lm.ReleaseAll(t2);
+
+  // Restarted, txn 2 takes key 2. Older txn 1 may wait for it.
+  lm.BeginAcquire(t2);
+  EXPECT_TRUE(lm.WriteLock(t2, 2));
+  EXPECT_TRUE(lm.EndAcquire(t2));
+  EXPECT_FALSE(lm.Aborted(t2));
+  lm.BeginAcquire(t1);
+  EXPECT_FALSE(lm.WriteLock(t1, 2));
+  EXPECT_FALSE(lm.Aborted(t1));
+  EXPECT_FALSE(lm.EndAcquire(t1));
+  EXPECT_EQ(1, lm.AbortCount());
+  EXPECT_EQ(0, ready_txns.Size());
+
+  // Once txn 2 is done, txn 1 gets key 2.
+  lm.ReleaseAll(t2);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t1, ready);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(2, &owners));
+  EXPECT_EQ(t1, owners[0]);
+
+  lm.ReleaseAll(t1);
+  EXPECT_EQ(UNLOCKED, lm.Status(1, &owners));
+  EXPECT_EQ(UNLOCKED, lm.Status(2, &owners));
+
+  delete t1;
+  delete t2;
+  END;
+}
+
+TEST(LockManagerA_WoundWait)
+{
+  AtomicQueue<Txn *> ready_txns;
+  LockManagerA lm(&ready_txns, WOUND_WAIT);
+  vector<Txn *> owners;
+  Txn *ready;
+
+  Txn *t1 = new AgedNoop(1);
+  Txn *t2 = new AgedNoop(2);
+  Txn *t3 = new AgedNoop(3);
+
+  // Younger txn 2 holds key 1 and is still requesting locks.
+  lm.BeginAcquire(t2);
+  EXPECT_TRUE(lm.WriteLock(t2, 1));
+
+  // Older txn 1 wounds it, and waits for it to roll back.
+  lm.BeginAcquire(t1);
+  EXPECT_FALSE(lm.WriteLock(t1, 1));
+  EXPECT_TRUE(lm.Aborted(t2));
+  EXPECT_FALSE(lm.Aborted(t1));
+  EXPECT_EQ(1, lm.AbortCount());
+  EXPECT_FALSE(lm.EndAcquire(t1));
+  EXPECT_TRUE(lm.EndAcquire(t2));
+  EXPECT_EQ(0, ready_txns.Size());
+
+  // Rolling txn 2 back hands key 1 to txn 1.
+  lm.ReleaseAll(t2);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t1, ready);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(1, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t1, owners[0]);
+
+  // Younger txn 3 simply waits for txn 1.
+  lm.BeginAcquire(t3);
+  EXPECT_FALSE(lm.WriteLock(t3, 1));
+  EXPECT_FALSE(lm.Aborted(t3));
+  EXPECT_FALSE(lm.Aborted(t1));
+  EXPECT_FALSE(lm.EndAcquire(t3));
+  lm.ReleaseAll(t1);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t3, ready);
+  lm.ReleaseAll(t3);
+
+  // A younger txn that holds all of its locks is not wounded.
+  lm.BeginAcquire(t2);
+  EXPECT_TRUE(lm.WriteLock(t2, 2));
+  EXPECT_TRUE(lm.EndAcquire(t2));
+  lm.BeginAcquire(t1);
+  EXPECT_FALSE(lm.WriteLock(t1, 2));
+  EXPECT_FALSE(lm.Aborted(t2));
+  EXPECT_FALSE(lm.EndAcquire(t1));
+  EXPECT_EQ(1, lm.AbortCount());
+  lm.ReleaseAll(t2);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t1, ready);
+
+  lm.ReleaseAll(t1);
+  EXPECT_EQ(UNLOCKED, lm.Status(1, &owners));
+  EXPECT_EQ(UNLOCKED, lm.Status(2, &owners));
+
+  delete t1;
+  delete t2;
+  delete t3;
+  END;
+}
+
+TEST(LockManagerB_SimpleLocking)
+{
+  AtomicQueue<Txn *> ready_txns;
+  Storage storage;
+  LockManagerB lm(&ready_txns, &storage);
+  vector<Txn *> owners;
+  Txn *ready;
+
+  // the lock counts are kept in the record, so it must exist
+  storage.Write(101, 0);
+
+  set<Key> key;
+  key.insert(101);
+  Txn *t1 = new RMW(key, set<Key>());
+  Txn *t2 = new RMW(set<Key>(), key);
+  Txn *t3 = new RMW(key, set<Key>());
+
+  // Txn 1 acquires read lock.
+  lm.BeginAcquire(t1);
+  EXPECT_TRUE(lm.ReadLock(t1, 101));
+  EXPECT_TRUE(lm.EndAcquire(t1));
+  EXPECT_EQ(SHARED, lm.Status(101, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t1, owners[0]);
+
+  // Txn 2 requests write lock. Not granted.
+  lm.BeginAcquire(t2);
+  EXPECT_FALSE(lm.WriteLock(t2, 101));
+  EXPECT_FALSE(lm.EndAcquire(t2));
+
+  // Txn 3 requests read lock. Not granted (it is queued behind txn 2).
+  lm.BeginAcquire(t3);
+  EXPECT_FALSE(lm.ReadLock(t3, 101));
+  EXPECT_FALSE(lm.EndAcquire(t3));
+  EXPECT_EQ(SHARED, lm.Status(101, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t1, owners[0]);
+  EXPECT_EQ(0, ready_txns.Size());
+
+  // Txn 1 releases lock. Txn 2 reaches the front of the queue.
+  lm.ReleaseAll(t1);
+  EXPECT_EQ(EXCLUSIVE, lm.Status(101, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t2, owners[0]);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t2, ready);
+
+  // Txn 2 releases lock. Txn 3 reaches the front of the queue.
+  lm.ReleaseAll(t2);
+  EXPECT_EQ(SHARED, lm.Status(101, &owners));
+  EXPECT_EQ(1, owners.size());
+  EXPECT_EQ(t3, owners[0]);
+  EXPECT_EQ(1, ready_txns.Size());
+  EXPECT_TRUE(ready_txns.Pop(&ready));
+  EXPECT_EQ(t3, ready);
+
+  lm.ReleaseAll(t3);
   EXPECT_EQ(UNLOCKED, lm.Status(101, &owners));
   EXPECT_EQ(0, owners.size());
+  EXPECT_EQ(0, storage.GetRecord(101)->cx_);
+  EXPECT_EQ(0, storage.GetRecord(101)->cs_);
+
+  delete t1;
+  delete t2;
+  delete t3;
   END;
 }
 
 int main(int argc, char **argv)
 {
   LockManagerA_SimpleLocking();
+  LockManagerA_AcquisitionPhase();
+  LockManagerA_ReleaseAll();
+  LockManagerA_ReleaseShared();
+  LockManagerA_AcquireAll();
+  LockManagerA_GranuleLocking();
+  LockManagerA_DeadlockDetection();
+  LockManagerA_WaitDie();
+  LockManagerA_WoundWait();
+  LockManagerB_SimpleLocking();
 }
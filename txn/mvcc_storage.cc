@@ -2,154 +2,377 @@
 
 #include "txn/mvcc_storage.h"
 
+#include <stdlib.h>
+#include <algorithm>
+#include <new>
+
+// Return every slab to the system.
+VersionPool::~VersionPool() {
+  for (auto slab : slabs_) {
+    for (int i = 0; i < slab.second; i++) {
+      slab.first[i].~Version();
+    }
+    free(slab.first);
+  }
+}
+
+// Get a version, from the freed ones if there are any.
+Version* VersionPool::New() {
+  mutex_.Lock();
+  Version* version = free_;
+  if (version != NULL) {
+    free_ = version->next_;
+  } else {
+    if (slab_next_ == slab_end_) {
+      AddSlab(VERSION_SLAB_SIZE);
+    }
+    version = slab_next_++;
+  }
+  mutex_.Unlock();
+  return version;
+}
+
+// Free a whole list of versions, a run from the same pool at a time.
+void VersionPool::Delete(Version* first) {
+  while (first != NULL) {
+    VersionPool* pool = first->pool_;
+    Version* last = first;
+    last->sireads_.clear();
+    while (last->next_ != NULL && last->next_->pool_ == pool) {
+      last = last->next_;
+      last->sireads_.clear();
+    }
+    Version* rest = last->next_;
+
+    pool->mutex_.Lock();
+    last->next_ = pool->free_;
+    pool->free_ = first;
+    pool->mutex_.Unlock();
+    first = rest;
+  }
+}
+
+// Make room for count versions in one slab.
+void VersionPool::Reserve(int count) {
+  mutex_.Lock();
+  if (slab_end_ - slab_next_ < count) {
+    AddSlab(count);
+  }
+  mutex_.Unlock();
+}
+
+// Get a slab of versions from the system. Requires mutex_ to be held.
+void VersionPool::AddSlab(int count) {
+  void* memory;
+  if (posix_memalign(&memory, CACHE_LINE_SIZE, count * sizeof(Version)) != 0) {
+    DIE("Failed to allocate a slab of versions");
+  }
+  slab_next_ = static_cast<Version*>(memory);
+  slab_end_ = slab_next_ + count;
+  for (Version* version = slab_next_; version != slab_end_; version++) {
+    new (version) Version();
+    version->pool_ = this;
+  }
+  slabs_.push_back(std::make_pair(slab_next_, count));
+}
+
 // Init the storage
 void MVCCStorage::InitStorage() {
-  for (int i = 0; i < 1000000;i++) {
+  // one allocation each for all the initial chains, versions and buckets
+  init_chains_ = new VersionChain[INIT_KEYS];
+  Pool()->Reserve(INIT_KEYS);
+  mvcc_data_.rehash(INIT_KEYS);
+  for (int i = 0; i < INIT_KEYS;i++) {
+    mvcc_data_[i] = &init_chains_[i];
     Write(i, 0, 0);
-    Mutex* key_mutex = new Mutex();
-    mutexs_[i] = key_mutex;
   }
 }
 
-// Free memory.
+// Free memory. The pools free the versions.
 MVCCStorage::~MVCCStorage() {
-  for (unordered_map<Key, deque<Version*>*>::iterator it = mvcc_data_.begin();
+  for (unordered_map<Key, VersionChain*>::iterator it = mvcc_data_.begin();
        it != mvcc_data_.end(); ++it) {
-    auto version_list = it->second;
-    for (auto version : *version_list) {
-      delete version;
+    if (it->second < init_chains_ || it->second >= init_chains_ + INIT_KEYS) {
+      delete it->second;
     }
-    delete version_list;          
   }
-  
+  delete[] init_chains_;
+
   mvcc_data_.clear();
-  
-  for (unordered_map<Key, Mutex*>::iterator it = mutexs_.begin();
-       it != mutexs_.end(); ++it) {
-    delete it->second;          
+}
+
+// Each thread sticks to one stripe of the storage it last allocated from, so
+// threads rarely contend for a stripe.
+VersionPool* MVCCStorage::Pool() {
+  static __thread MVCCStorage* storage = NULL;
+  static __thread int stripe = 0;
+  if (storage != this) {
+    storage = this;
+    stripe = __sync_fetch_and_add(&next_stripe_, 1) % VERSION_POOL_STRIPES;
   }
-  
-  mutexs_.clear();
+  return &pools_[stripe];
 }
 
-// Lock the key to protect its version_list. Remember to lock the key when you read/update the version_list 
+// Take the writer bit of the key. Remember to lock the key when you update its versions
 void MVCCStorage::Lock(Key key) {
-  mutexs_[key]->Lock();
+  VersionChain* chain = mvcc_data_[key];
+  int spins = 0;
+  while (true) {
+    uint64 word = chain->word_;
+    if ((word & TID_LOCK_BIT) == 0 &&
+        __sync_bool_compare_and_swap(&chain->word_, word, word | TID_LOCK_BIT)) {
+      return;
+    }
+    SpinWait(&spins);
+  }
 }
 
-// Unlock the key.
+// Release the writer bit, telling readers that the versions may have changed.
 void MVCCStorage::Unlock(Key key) {
-  mutexs_[key]->Unlock();
+  VersionChain* chain = mvcc_data_[key];
+  __sync_synchronize();
+  chain->word_ = (chain->word_ & ~TID_LOCK_BIT) + 1;
+}
+
+// Reserve key, then wait for the writer that may have taken it before.
+void MVCCStorage::Reserve(Key key) {
+  VersionChain* chain = mvcc_data_[key];
+  int spins = 0;
+  while (!__sync_bool_compare_and_swap(&chain->reserved_, 0, 1)) {
+    SpinWait(&spins);
+  }
+  spins = 0;
+  while ((chain->word_ & TID_LOCK_BIT) != 0) {
+    SpinWait(&spins);
+  }
+}
+
+// Release the reservation of key.
+void MVCCStorage::Unreserve(Key key) {
+  __sync_synchronize();
+  mvcc_data_[key]->reserved_ = 0;
+}
+
+// Whether key is reserved.
+bool MVCCStorage::Reserved(Key key) {
+  return mvcc_data_[key]->reserved_ != 0;
+}
+
+// Returns the latest version whose write timestamp (version_id) is less than
+// or equal to txn_unique_id, or NULL if there is none.
+Version* MVCCStorage::FindVersion(VersionChain* chain, int txn_unique_id) {
+  // txns mostly read and write the latest version, which is the head
+  Version* version = chain->head_;
+  while (version != NULL && version->version_id_ > txn_unique_id) {
+    version = version->next_;
+  }
+  return version;
+}
+
+// Raise the read timestamp of version to txn_unique_id
+static void UpdateMaxReadId(Version* version, int txn_unique_id) {
+  int max_read_id = version->max_read_id_;
+  while (max_read_id < txn_unique_id &&
+         !__sync_bool_compare_and_swap(&version->max_read_id_, max_read_id, txn_unique_id)) {
+    max_read_id = version->max_read_id_;
+  }
 }
 
 // MVCC Read
 bool MVCCStorage::Read(Key key, Value* result, int txn_unique_id) {
-  // get version list for key
+  // get version chain for key
   auto key_versions = mvcc_data_.find(key);
   if (key_versions == mvcc_data_.end()) {
     return false;
   }
+  VersionChain* chain = key_versions->second;
 
-  auto version_list = key_versions->second;
-  if (version_list->empty()) {
-    return false;
-  }
+  // A writer checks max_read_id_ before it adds a version, so read again if
+  // one held the key while we read, or we might miss its version while it
+  // misses our read timestamp. Writers only hold the key to check and
+  // install their versions, so back off briefly rather than give up.
+  int spins = 0;
+  while (true) {
+    uint64 word = chain->word_;
+    if ((word & TID_LOCK_BIT) != 0) {
+      SpinWait(&spins);
+      continue;
+    }
+    __sync_synchronize();
 
-  // Iterate the version_lists and return the verion whose write timestamp
-  // (version_id) is the largest write timestamp less than or equal to txn_unique_id.
-  auto latest_version = version_list->begin();
-  for (auto itr = version_list->begin(); itr != version_list->end(); itr++) {
-    if ((*itr)->version_id_ > (*latest_version)->version_id_ && (*itr)->version_id_ <= txn_unique_id) {
-      // get latest version with timestamp less or equal to txn_unique_id
-      latest_version = itr;
+    // get value and update read timestamp
+    Version* latest_version = FindVersion(chain, txn_unique_id);
+    if (latest_version != NULL) {
+      *result = latest_version->value_;
+      UpdateMaxReadId(latest_version, txn_unique_id);
     }
+
+    __sync_synchronize();
+    if (chain->word_ == word) {
+      return latest_version != NULL;
+    }
+    SpinWait(&spins);
   }
-  
-  // get value and update read timestamp
-  *result = (*latest_version)->value_;
-  if ((*latest_version)->max_read_id_ < txn_unique_id) {
-    (*latest_version)->max_read_id_ = txn_unique_id;
+}
+
+// MVCC Read of a snapshot no txn writes to
+bool MVCCStorage::SnapshotRead(Key key, Value* result, int txn_unique_id) {
+  auto key_versions = mvcc_data_.find(key);
+  if (key_versions == mvcc_data_.end()) {
+    return false;
+  }
+
+  Version* latest_version = FindVersion(key_versions->second, txn_unique_id);
+  if (latest_version == NULL) {
+    return false;
   }
+  *result = latest_version->value_;
   return true;
 }
 
-
 // Check whether apply or abort the write
 bool MVCCStorage::CheckWrite(Key key, int txn_unique_id) {
   auto key_versions = mvcc_data_.find(key);
-  
+
   // no key exist in version database, return true
   if (key_versions == mvcc_data_.end()) {
     return true;
   }
 
-  auto version_list = key_versions->second;
+  VersionChain* chain = key_versions->second;
+  Version* valid_version = FindVersion(chain, txn_unique_id);
 
-  // Iterate the version_lists
-  // get latest version where write timestamp less than or equal to txn_unique_id.
-  auto valid_version = version_list->begin();
-  for (auto itr = version_list->begin(); itr != version_list->end(); itr++) {
-    if ((*itr)->version_id_ > (*valid_version)->version_id_ && (*itr)->version_id_ <= txn_unique_id) {
-      // get latest version with timestamp less or equal to txn_unique_id
-      valid_version = itr;
-    }
-  }
-
-  // no valid version exists
-  if ((*valid_version)->version_id_ > txn_unique_id) {
+  // Txns read at their own timestamp, so a write must become the latest
+  // version, and must not come after a version a later txn has read.
+  // Otherwise, two txns that read the same version could both write after
+  // it, and the earlier one's write would be lost below the later one's.
+  if (valid_version == NULL || valid_version != chain->head_ ||
+      valid_version->max_read_id_ > txn_unique_id) {
     return false;
   } else {
     return true;
   }
 }
 
+// Check whether a snapshot isolation write conflicts with a later one
+bool MVCCStorage::CheckSnapshotWrite(Key key, int txn_unique_id) {
+  auto key_versions = mvcc_data_.find(key);
+  if (key_versions == mvcc_data_.end() || key_versions->second->head_ == NULL) {
+    return true;
+  }
+
+  // the latest version must be part of the txn's snapshot
+  return key_versions->second->head_->version_id_ <= txn_unique_id;
+}
+
+// Leave an SIREAD marker on the version the txn reads
+void MVCCStorage::MarkRead(Key key, int txn_unique_id, vector<int>* later_versions) {
+  auto key_versions = mvcc_data_.find(key);
+  if (key_versions == mvcc_data_.end()) {
+    return;
+  }
+
+  Version* version = key_versions->second->head_;
+  while (version != NULL && version->version_id_ > txn_unique_id) {
+    later_versions->push_back(version->version_id_);
+    version = version->next_;
+  }
+  if (version != NULL) {
+    version->sireads_.push_back(txn_unique_id);
+  }
+}
+
+// Get the txns with SIREAD markers on key
+void MVCCStorage::GetReaders(Key key, vector<int>* readers) {
+  auto key_versions = mvcc_data_.find(key);
+  if (key_versions == mvcc_data_.end()) {
+    return;
+  }
+
+  for (Version* version = key_versions->second->head_; version != NULL;
+       version = version->next_) {
+    readers->insert(readers->end(), version->sireads_.begin(), version->sireads_.end());
+  }
+}
+
 // MVCC Write, call this method only if CheckWrite return true.
 void MVCCStorage::Write(Key key, Value value, int txn_unique_id) {
-  // create version, assume malloc succeeds
-  Version* to_write = new Version;
+  // get key version chain
+  auto key_versions = mvcc_data_.find(key);
+
+  VersionChain* chain;
+  if (key_versions == mvcc_data_.end()) {
+    // no versions exists for key, insert first version
+    chain = new VersionChain();
+    mvcc_data_[key] = chain;
+  } else {
+    chain = key_versions->second;
+  }
+
+  // find where the version goes, keeping the chain ordered from the latest
+  // version to the oldest one
+  Version* volatile* link = &chain->head_;
+  while (*link != NULL && (*link)->version_id_ > txn_unique_id) {
+    link = &(*link)->next_;
+  }
+
+  if (*link != NULL && (*link)->version_id_ == txn_unique_id) {
+    // if same timestamp, update value
+    (*link)->value_ = value;
+    return;
+  }
+
+  // create version, and publish it with a single CAS, so readers either see
+  // all of it or walk past where it goes
+  Version* to_write = Pool()->New();
   to_write->value_ = value;
   to_write->version_id_ = txn_unique_id;
   to_write->max_read_id_ = txn_unique_id;
+  do {
+    to_write->next_ = *link;
+  } while (!__sync_bool_compare_and_swap(link, to_write->next_, to_write));
+}
 
-  // get key versions deque
+// Garbage collect the versions of key no active txn can read.
+void MVCCStorage::GarbageCollect(Key key, int low_watermark) {
   auto key_versions = mvcc_data_.find(key);
-
   if (key_versions == mvcc_data_.end()) {
-    // no versions exists for key, insert first version
-    deque<Version*>* versions = new deque<Version*>();
-    versions->push_front(to_write);
-    mvcc_data_[key] = versions;
     return;
   }
+  VersionChain* chain = key_versions->second;
 
-  // ELSE, versions exists for key
-  auto version_list = key_versions->second;
-  if (version_list->empty()) {
-    // redundant check, check if version_list is empty
-    version_list = new deque<Version*>();
-    version_list->push_front(to_write);
+  // every txn at or above the watermark reads this version or a later one,
+  // so no reader walks past it, and the versions after it can be freed at once
+  Version* oldest_visible = FindVersion(chain, low_watermark);
+  if (oldest_visible == NULL) {
     return;
   }
+  Version* garbage = oldest_visible->next_;
+  oldest_visible->next_ = NULL;
+  VersionPool::Delete(garbage);
 
-
-  // // Iterate the version_lists
-  // // get latest version where write timestamp less than or equal to txn_unique_id.
-  auto latest_valid_version = version_list->begin();
-  for (auto itr = version_list->begin(); itr != version_list->end(); itr++) {
-    if ((*itr)->version_id_ > (*latest_valid_version)->version_id_ && (*itr)->version_id_ <= txn_unique_id) {
-      // get latest version with timestamp less or equal to txn_unique_id
-      latest_valid_version = itr;
-    }
+  // txns below the watermark have no concurrent txns left to conflict with
+  for (Version* version = chain->head_; version != NULL; version = version->next_) {
+    auto& sireads = version->sireads_;
+    sireads.erase(remove_if(sireads.begin(), sireads.end(),
+                            [low_watermark](int id) {
+                              return id < low_watermark;
+                            }),
+                  sireads.end());
   }
+}
 
-  if ((*latest_valid_version)->version_id_ == txn_unique_id) {
-    // if same timestamp, update value
-    (*latest_valid_version)->value_ = value;
-    delete to_write;
-  } else {
-    // create new version
-    version_list->push_front(to_write);
+// Garbage collect the next count keys.
+void MVCCStorage::Sweep(int low_watermark, int count) {
+  for (int i = 0; i < count; i++, sweep_cursor_++) {
+    if (sweep_cursor_ >= mvcc_data_.size()) {
+      sweep_cursor_ = 0;
+    }
+    if (mvcc_data_.count(sweep_cursor_) == 0) {
+      continue;
+    }
+    Lock(sweep_cursor_);
+    GarbageCollect(sweep_cursor_, low_watermark);
+    Unlock(sweep_cursor_);
   }
 }
-
-
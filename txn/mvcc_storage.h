@@ -4,52 +4,181 @@
 
 #include "txn/storage.h"
 
+// Size of a cache line, which versions are aligned to, so that no version
+// shares a cache line with another one
+#define CACHE_LINE_SIZE 64
+
+// Number of versions a VersionPool gets from the system at once
+#define VERSION_SLAB_SIZE 4096
+
+// Number of stripes of the version pool of an MVCCStorage. Each thread
+// allocates from one stripe, and the threads share the stripes round robin.
+#define VERSION_POOL_STRIPES 16
+
+class VersionPool;
+
 // MVCC 'version' structure
-struct Version {
+struct __attribute__((aligned(CACHE_LINE_SIZE))) Version {
   Value value_;      // The value of this version
-  int max_read_id_;  // Largest timestamp of a transaction that read the version
+  volatile int max_read_id_;  // Largest timestamp of a transaction that read the version
   int version_id_;   // Timestamp of the transaction that created(wrote) the version
+  vector<int> sireads_;  // Timestamps of the SSI transactions that read the version
+  Version* volatile next_;  // The next older version of the same key
+  VersionPool* pool_;  // The pool that allocated the version, and gets it back
+};
+
+// Slab allocator of versions. Freed versions go back to the pool that
+// allocated them, and are kept there for reuse, along with the memory of
+// their SIREAD markers, until the pool is destroyed.
+class VersionPool {
+ public:
+  VersionPool() : free_(NULL), slab_next_(NULL), slab_end_(NULL) {}
+
+  ~VersionPool();
+
+  // Returns a version with no SIREAD markers.
+  Version* New();
+
+  // Frees first and the versions linked from it through next_, each to the
+  // pool that allocated it.
+  static void Delete(Version* first);
+
+  // Makes sure that the next count calls to New() do not need to allocate
+  // more than one slab.
+  void Reserve(int count);
+
+ private:
+  // Gets a slab of count versions from the system.
+  void AddSlab(int count);
+
+  Mutex mutex_;
+
+  // Freed versions, linked through next_
+  Version* free_;
+
+  // Versions of the last slab that have not been handed out yet
+  Version* slab_next_;
+  Version* slab_end_;
+
+  // Every slab, with the number of versions in it
+  vector<std::pair<Version*, int> > slabs_;
+};
+
+// The versions of a key, linked from the latest one to the oldest one. Readers
+// walk them without latches. Writers hold TID_LOCK_BIT of 'word_' while they
+// check or change them, and bump the rest of 'word_' when they are done.
+// 'reserved_' is set while an escalated txn keeps other writers off the key.
+struct VersionChain {
+  VersionChain() : head_(NULL), word_(0), reserved_(0) {}
+
+  Version* volatile head_;
+  volatile uint64 word_;
+  volatile int reserved_;
 };
 
 // MVCC storage
 class MVCCStorage : public Storage {
  public:
+  MVCCStorage() : init_chains_(NULL), next_stripe_(0), sweep_cursor_(0) {}
+
   // If there exists a record for the specified key, sets '*result' equal to
   // the value associated with the key and returns true, else returns false;
   // The third parameter is the txn_unique_id(txn timestamp), which is used for MVCC.
+  // Takes no latch, but waits for a writer holding the key to release it, so
+  // the caller must not hold the key itself.
   virtual bool Read(Key key, Value* result, int txn_unique_id = 0);
 
+  // Like Read(), but does not update max_read_id_. Only for txn_unique_ids
+  // that no txn can write at any more.
+  virtual bool SnapshotRead(Key key, Value* result, int txn_unique_id);
+
   // Inserts a new version with key and value
   // The third parameter is the txn_unique_id(txn timestamp), which is used for MVCC.
   virtual void Write(Key key, Value value, int txn_unique_id = 0);
 
-  // Returns the timestamp at which the record with the specified key was last
+  // Returns the number of times the record with the specified key has been
   // updated (returns 0 if the record has never been updated). This is used for OCC.
-  virtual double Timestamp(Key key) {return 0;}
+  virtual uint64 RecordVersion(Key key) {return 0;}
   
   // Init storage
   virtual void InitStorage();
   
-  // Lock the version_list of key
+  // Take the writer bit of key, which Write(), CheckWrite(),
+  // CheckSnapshotWrite(), MarkRead(), GetReaders() and GarbageCollect()
+  // require
   virtual void Lock(Key key);
   
-  // Unlock the version_list of key
+  // Release the writer bit of key
   virtual void Unlock(Key key);
+
+  // Reserve key for one writer, which other writers are expected to check
+  // for with Reserved() while they hold the key. Waits until no other writer
+  // has it reserved, and then until no writer holds it, so every writer
+  // that takes it later sees the reservation. Readers are not held off.
+  virtual void Reserve(Key key);
+
+  // Release the reservation of key
+  virtual void Unreserve(Key key);
+
+  // Whether key is reserved
+  virtual bool Reserved(Key key);
   
-  // Check whether apply or abort the write
+  // Check whether apply or abort the write. It is applied only if no txn
+  // later than txn_unique_id has written key, or read the version it replaces
+  // (multiversion timestamp ordering).
   virtual bool CheckWrite (Key key, int txn_unique_id);
+
+  // Check whether a txn reading the snapshot at txn_unique_id may write key,
+  // i.e. whether no other txn has written key since (first committer wins)
+  virtual bool CheckSnapshotWrite(Key key, int txn_unique_id);
+
+  // Leaves an SIREAD marker of the txn on the version of key it reads, and
+  // appends the version_id_ of every later version to later_versions.
+  virtual void MarkRead(Key key, int txn_unique_id, vector<int>* later_versions);
+
+  // Appends the txn_unique_id of every txn with an SIREAD marker on a version
+  // of key to readers.
+  virtual void GetReaders(Key key, vector<int>* readers);
+
+  // Frees the versions of key that no txn with a txn_unique_id of at least
+  // low_watermark can read any more, and the SIREAD markers of txns below it.
+  // The key must be locked.
+  virtual void GarbageCollect(Key key, int low_watermark);
+
+  // Calls GarbageCollect() on the next count keys, locking each of them in
+  // turn, and wraps around after the last key.
+  virtual void Sweep(int low_watermark, int count);
   
   virtual ~MVCCStorage();
 
  private:
  
   friend class TxnProcessor;
+
+  // Returns the stripe of pools_ the calling thread allocates from.
+  VersionPool* Pool();
+
+  // Returns the latest version in chain that a txn with txn_unique_id can
+  // read, or NULL if there is none. Takes constant time when that is the
+  // latest version.
+  Version* FindVersion(VersionChain* chain, int txn_unique_id);
   
-  // Storage for MVCC, each key has a linklist of versions
-  unordered_map<Key, deque<Version*>*> mvcc_data_;
-  
-  // Mutexs for each key
-  unordered_map<Key, Mutex*> mutexs_;
+  // Storage for MVCC, each key has a chain of versions ordered by
+  // version_id_, the latest one first. Keys are only added by InitStorage().
+  unordered_map<Key, VersionChain*> mvcc_data_;
+
+  // Chains of the keys created by InitStorage(), allocated together
+  VersionChain* init_chains_;
+
+  // Allocators of all versions in mvcc_data_, striped over the threads
+  VersionPool pools_[VERSION_POOL_STRIPES];
+
+  // Stripe of pools_ the next thread to allocate a version gets
+  int next_stripe_;
+
+  // Next key Sweep() collects. Keys are 0 up to the number of keys created by
+  // InitStorage().
+  Key sweep_cursor_;
 };
 
 #endif  // _MVCC_STORAGE_H_
@@ -0,0 +1,240 @@
+#include "txn/mvcc_storage.h"
+
+#include <vector>
+
+#include "utils/testing.h"
+
+using std::vector;
+
+TEST(MVCCStorage_CheckWrite)
+{
+  MVCCStorage storage;
+  Value result;
+
+  storage.Write(0, 0, 0);
+
+  // txns 5 and 6 both read version 0
+  EXPECT_TRUE(storage.Read(0, &result, 5));
+  EXPECT_TRUE(storage.Read(0, &result, 6));
+  storage.Lock(0);
+
+  // txn 6 writes after version 0, so txn 5 may no longer write between them,
+  // or txn 6 would have read the wrong version and txn 5's write would be lost
+  EXPECT_TRUE(storage.CheckWrite(0, 6));
+  storage.Write(0, 1, 6);
+  EXPECT_FALSE(storage.CheckWrite(0, 5));
+
+  // a txn that reads version 6 may write after it, unless a later txn reads
+  // it first
+  EXPECT_TRUE(storage.CheckWrite(0, 7));
+  storage.Unlock(0);
+  EXPECT_TRUE(storage.Read(0, &result, 9));
+  EXPECT_EQ(1, result);
+  storage.Lock(0);
+  EXPECT_FALSE(storage.CheckWrite(0, 7));
+  EXPECT_TRUE(storage.CheckWrite(0, 9));
+  EXPECT_TRUE(storage.CheckWrite(0, 10));
+
+  // keys with no versions yet can always be written
+  EXPECT_TRUE(storage.CheckWrite(1, 1));
+
+  storage.Unlock(0);
+  END;
+}
+
+TEST(MVCCStorage_Reserve)
+{
+  MVCCStorage storage;
+  Value result;
+
+  storage.Write(0, 1, 1);
+  EXPECT_FALSE(storage.Reserved(0));
+  storage.Reserve(0);
+  EXPECT_TRUE(storage.Reserved(0));
+
+  // readers are not held off, and writers can still see the reservation
+  // while they hold the key
+  EXPECT_TRUE(storage.Read(0, &result, 2));
+  EXPECT_EQ(1, result);
+  storage.Lock(0);
+  EXPECT_TRUE(storage.Reserved(0));
+  storage.Unlock(0);
+
+  storage.Unreserve(0);
+  EXPECT_FALSE(storage.Reserved(0));
+  END;
+}
+
+TEST(MVCCStorage_GarbageCollect)
+{
+  MVCCStorage storage;
+  Value result;
+
+  // key 0 gets the versions 1 to 100, each holding its own version_id_
+  for (int id = 1; id <= 100; id++)
+    storage.Write(0, id, id);
+
+  storage.Lock(0);
+  storage.GarbageCollect(0, 90);
+  storage.Unlock(0);
+
+  // txns at the watermark or above still read what they did before
+  EXPECT_TRUE(storage.SnapshotRead(0, &result, 90));
+  EXPECT_EQ(90, result);
+  EXPECT_TRUE(storage.SnapshotRead(0, &result, 95));
+  EXPECT_EQ(95, result);
+  EXPECT_TRUE(storage.SnapshotRead(0, &result, 1000));
+  EXPECT_EQ(100, result);
+
+  // and nothing older is left
+  EXPECT_FALSE(storage.SnapshotRead(0, &result, 89));
+  EXPECT_FALSE(storage.SnapshotRead(0, &result, 1));
+
+  // a watermark between two versions keeps the older one, which txns at the
+  // watermark read
+  storage.Write(1, 10, 10);
+  storage.Write(1, 20, 20);
+  storage.Write(1, 30, 30);
+  storage.Lock(1);
+  storage.GarbageCollect(1, 25);
+  storage.Unlock(1);
+  EXPECT_TRUE(storage.SnapshotRead(1, &result, 25));
+  EXPECT_EQ(20, result);
+  EXPECT_FALSE(storage.SnapshotRead(1, &result, 15));
+
+  END;
+}
+
+TEST(MVCCStorage_GarbageCollectSIReads)
+{
+  MVCCStorage storage;
+  vector<int> later_versions;
+  vector<int> readers;
+
+  storage.Write(0, 0, 10);
+  storage.Write(0, 0, 20);
+  storage.Lock(0);
+  storage.MarkRead(0, 15, &later_versions);
+  storage.MarkRead(0, 25, &later_versions);
+  storage.MarkRead(0, 35, &later_versions);
+  EXPECT_EQ(1, static_cast<int>(later_versions.size()));
+  EXPECT_EQ(20, later_versions[0]);
+
+  // only the markers of txns below the watermark go
+  storage.GarbageCollect(0, 30);
+  storage.GetReaders(0, &readers);
+  storage.Unlock(0);
+  EXPECT_EQ(1, static_cast<int>(readers.size()));
+  EXPECT_EQ(35, readers[0]);
+
+  END;
+}
+
+TEST(MVCCStorage_Sweep)
+{
+  MVCCStorage storage;
+  Value result;
+
+  // the chains of keys 0 to 9 grow by one version per round, while the
+  // watermark follows right behind, so each chain stays at two versions
+  for (int round = 1; round <= 1000; round++)
+  {
+    for (Key key = 0; key < 10; key++)
+      storage.Write(key, round, round);
+    storage.Sweep(round - 1, 10);
+  }
+
+  for (Key key = 0; key < 10; key++)
+  {
+    EXPECT_TRUE(storage.SnapshotRead(key, &result, 1000));
+    EXPECT_EQ(1000, result);
+    EXPECT_TRUE(storage.SnapshotRead(key, &result, 999));
+    EXPECT_EQ(999, result);
+    EXPECT_FALSE(storage.SnapshotRead(key, &result, 998));
+  }
+
+  END;
+}
+
+TEST(VersionPool_Reuse)
+{
+  VersionPool pool;
+  vector<Version *> versions;
+
+  // versions come aligned to cache lines, each on its own
+  for (int i = 0; i < VERSION_SLAB_SIZE + 10; i++)
+  {
+    Version *version = pool.New();
+    EXPECT_EQ(0, static_cast<int>(reinterpret_cast<uintptr_t>(version) % CACHE_LINE_SIZE));
+    EXPECT_TRUE(version->sireads_.empty());
+    version->sireads_.push_back(i);
+    versions.push_back(version);
+  }
+  EXPECT_EQ(0, static_cast<int>(sizeof(Version) % CACHE_LINE_SIZE));
+
+  // freed lists of versions are handed out again, without their SIREAD
+  // markers
+  for (int i = 0; i < 9; i++)
+    versions[i]->next_ = versions[i + 1];
+  versions[9]->next_ = NULL;
+  VersionPool::Delete(versions[0]);
+  VersionPool::Delete(NULL);
+  for (int i = 0; i < 10; i++)
+  {
+    Version *version = pool.New();
+    bool reused = false;
+    for (int j = 0; j < 10; j++)
+      reused = reused || version == versions[j];
+    EXPECT_TRUE(reused);
+    EXPECT_TRUE(version->sireads_.empty());
+  }
+
+  // Reserve() leaves room for that many versions in one slab
+  pool.Reserve(100);
+  Version *first = pool.New();
+  for (int i = 1; i < 100; i++)
+    EXPECT_EQ(first + i, pool.New());
+
+  END;
+}
+
+TEST(VersionPool_Owners)
+{
+  VersionPool a;
+  VersionPool b;
+
+  // a list mixing the versions of two pools is split between them again
+  Version *list = NULL;
+  for (int i = 0; i < 10; i++)
+  {
+    Version *version = (i % 3 == 0 ? b : a).New();
+    version->next_ = list;
+    list = version;
+  }
+  VersionPool::Delete(list);
+  for (int i = 0; i < 10; i++)
+  {
+    VersionPool &pool = i < 6 ? a : b;
+    EXPECT_TRUE(pool.New()->pool_ == &pool);
+  }
+
+  // and each pool only hands out its own versions
+  Version *version = a.New();
+  version->next_ = NULL;
+  VersionPool::Delete(version);
+  EXPECT_TRUE(b.New() != version);
+  EXPECT_TRUE(a.New() == version);
+
+  END;
+}
+
+int main(int argc, char **argv)
+{
+  MVCCStorage_CheckWrite();
+  MVCCStorage_Reserve();
+  MVCCStorage_GarbageCollect();
+  MVCCStorage_GarbageCollectSIReads();
+  MVCCStorage_Sweep();
+  VersionPool_Reuse();
+  VersionPool_Owners();
+}
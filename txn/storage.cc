@@ -2,29 +2,35 @@
 #include "txn/storage.h"
 
 bool Storage::Read(Key key, Value* result, int txn_unique_id) {
-  if (data_.count(key)) {
-    *result = data_[key];
+  unordered_map<Key, Record>::iterator it = records_.find(key);
+  if (it != records_.end() && it->second.version_ != 0) {
+    *result = it->second.value_;
     return true;
   } else {
     return false;
   }
 }
 
-// Write value and timestamps
+// Write value and bump the version
 void Storage::Write(Key key, Value value, int txn_unique_id) {
-  data_[key] = value;
-  timestamps_[key] = GetTime();
+  Record* record = &records_[key];
+  record->value_ = value;
+  record->writer_ = txn_unique_id;
+  __sync_synchronize();
+  record->version_++;
 }
 
-double Storage::Timestamp(Key key) {
-  if (timestamps_.count(key) == 0)
+uint64 Storage::RecordVersion(Key key) {
+  unordered_map<Key, Record>::iterator it = records_.find(key);
+  if (it == records_.end())
     return 0;
-  return timestamps_[key];
+  return it->second.version_;
 }
 
-// Init the storage
+// Init the storage, sizing the table once for all its records
 void Storage::InitStorage() {
-  for (int i = 0; i < 1000000;i++) {
+  records_.rehash(INIT_KEYS);
+  for (int i = 0; i < INIT_KEYS;i++) {
     Write(i, 0, 0);
   } 
 }
@@ -15,6 +15,53 @@ using std::tr1::unordered_map;
 using std::deque;
 using std::map;
 
+// Set in Record::tid_ (for SILO) or Record::wts_ (for TICTOC) while a
+// committing txn holds the record.
+#define TID_LOCK_BIT (1ULL << 63)
+
+// Number of low bits of a Silo TID that order commits within an epoch.
+#define TID_EPOCH_SHIFT 32
+
+// Number of keys InitStorage() creates
+#define INIT_KEYS 1000000
+
+// A single-version record, together with the per-record state of the
+// concurrency control schemes that keep it next to the data.
+struct Record {
+  Record()
+      : value_(0), writer_(0), version_(0), cx_(0), cs_(0), tid_(0), wts_(0),
+        rts_(0) {}
+
+  Value value_;
+
+  // unique_id_ of the txn that last wrote the record (used for early lock
+  // release).
+  uint64 writer_;
+
+  // Number of times the record has been written, or 0 if it has never been
+  // written (used for OCC). It is bumped after the new value is stored, so a
+  // reader that reads it before the value never pairs an old version with a
+  // newer value.
+  volatile uint64 version_;
+
+  // Number of txns holding or waiting for an exclusive (cx_) or shared (cs_)
+  // lock on the record, updated atomically (used for VLL).
+  volatile int cx_;
+  volatile int cs_;
+
+  // TID of the txn that last wrote the record: its commit epoch in the high
+  // bits and a sequence number within the epoch in the low TID_EPOCH_SHIFT
+  // bits, plus TID_LOCK_BIT while a txn is committing a write to it (used for
+  // SILO).
+  volatile uint64 tid_;
+
+  // Logical time at which the current value was written, plus TID_LOCK_BIT
+  // while a txn is committing a write to it or extending its 'rts_', and the
+  // last logical time at which the value is known to be valid (used for
+  // TICTOC).
+  volatile uint64 wts_;
+  volatile uint64 rts_;
+};
 
 class Storage {
  public:
@@ -24,15 +71,17 @@ class Storage {
   virtual bool Read(Key key, Value* result, int txn_unique_id = 0);
 
   // Inserts the record <key, value>, replacing any previous record with the
-  // same key.
+  // same key. Only keys that already have a record may be written while other
+  // threads use the storage.
   // Note that the third parameter is only used for MVCC, the default vaule is 0.
   virtual void Write(Key key, Value value, int txn_unique_id = 0);
 
-  // Returns the timestamp at which the record with the specified key was last
+  // Returns the number of times the record with the specified key has been
   // updated (returns 0 if the record has never been updated). This is used for OCC.
-  virtual double Timestamp(Key key);
+  virtual uint64 RecordVersion(Key key);
   
-  // Init storage
+  // Creates the records of keys 0 up to INIT_KEYS, which are all the keys
+  // txns may use.
   virtual void InitStorage();
   
   virtual ~Storage() {}
@@ -41,18 +90,47 @@ class Storage {
   virtual void Lock(Key key) {}
   
   virtual void Unlock(Key key) {}
+
+  virtual void Reserve(Key key) {}
+
+  virtual void Unreserve(Key key) {}
+
+  virtual bool Reserved(Key key) {return false;}
   
   virtual bool CheckWrite (Key key, int txn_unique_id) {return true;}
+
+  virtual bool CheckSnapshotWrite(Key key, int txn_unique_id) {return true;}
+
+  virtual bool SnapshotRead(Key key, Value* result, int txn_unique_id) {
+    return Read(key, result, txn_unique_id);
+  }
+
+  virtual void MarkRead(Key key, int txn_unique_id, vector<int>* later_versions) {}
+
+  virtual void GetReaders(Key key, vector<int>* readers) {}
+
+  virtual void GarbageCollect(Key key, int low_watermark) {}
+
+  virtual void Sweep(int low_watermark, int count) {}
+
+  // Returns the record with the specified key, which must have been created
+  // by InitStorage() or Write(). Used by concurrency control schemes that keep
+  // per-record state. It never changes the table, so any number of threads
+  // may call it at once.
+  Record* GetRecord(Key key) {
+    unordered_map<Key, Record>::iterator it = records_.find(key);
+    if (it == records_.end()) {
+      DIE("No record for key " << key);
+    }
+    return &it->second;
+  }
    
  private:
  
    friend class TxnProcessor;
    
-   // Collection of <key, value> pairs. Use this for single-version storage
-   unordered_map<Key, Value> data_;
-  
-   // Timestamps at which each key was last updated.
-   unordered_map<Key, double> timestamps_;
+   // Collection of <key, record> pairs. Use this for single-version storage
+   unordered_map<Key, Record> records_;
 };
 
 #endif  // _STORAGE_H_
@@ -1,6 +1,8 @@
 
 #include "txn/txn.h"
 
+#include "txn/storage.h"
+
 bool Txn::Read(const Key& key, Value* value) {
   // Check that key is in readset/writeset.
   if (readset_.count(key) == 0 && writeset_.count(key) == 0)
@@ -37,6 +39,18 @@ void Txn::Write(const Key& key, const Value& value) {
   reads_[key] = value;
 }
 
+bool Txn::Revalidate() {
+  if (occ_storage_ == NULL)
+    return true;
+
+  for (map<Key, uint64>::iterator it = occ_versions_.begin();
+       it != occ_versions_.end(); ++it) {
+    if (occ_storage_->RecordVersion(it->first) != it->second)
+      return false;
+  }
+  return true;
+}
+
 void Txn::CheckReadWriteSets() {
   for (set<Key>::iterator it = writeset_.begin();
        it != writeset_.end(); ++it) {
@@ -46,12 +60,23 @@ void Txn::CheckReadWriteSets() {
   }
 }
 
+void Txn::ComputeSignatures() {
+  read_signature_.Clear();
+  for (set<Key>::iterator it = readset_.begin(); it != readset_.end(); ++it)
+    read_signature_.Add(*it);
+  write_signature_.Clear();
+  for (set<Key>::iterator it = writeset_.begin(); it != writeset_.end(); ++it)
+    write_signature_.Add(*it);
+}
+
 void Txn::CopyTxnInternals(Txn* txn) const {
   txn->readset_ = set<Key>(this->readset_);
   txn->writeset_ = set<Key>(this->writeset_);
+  txn->read_signature_ = this->read_signature_;
+  txn->write_signature_ = this->write_signature_;
   txn->reads_ = map<Key, Value>(this->reads_);
   txn->writes_ = map<Key, Value>(this->writes_);
   txn->status_ = this->status_;
   txn->unique_id_ = this->unique_id_;
-  txn->occ_start_time_ = this->occ_start_time_;
+  txn->occ_versions_ = map<Key, uint64>(this->occ_versions_);
 }
@@ -8,10 +8,49 @@
 
 #include "txn/common.h"
 
+struct LockRequest;
+class Storage;
+
 using std::map;
 using std::set;
 using std::vector;
 
+// Number of 64-bit words in a Signature.
+#define SIGNATURE_WORDS 4
+
+// A fixed-width Bloom filter over a set of keys. Two sets whose signatures do
+// not intersect surely have no key in common, which takes a few word ANDs to
+// find out; if they do intersect, the sets themselves have to be checked.
+struct Signature {
+  Signature() { Clear(); }
+
+  void Clear() {
+    for (int i = 0; i < SIGNATURE_WORDS; i++)
+      bits_[i] = 0;
+  }
+
+  void Add(Key key) {
+    // Fibonacci hashing spreads consecutive keys over the whole filter
+    uint64 bit = ((key * 0x9E3779B97F4A7C15ULL) >> 32) % (64 * SIGNATURE_WORDS);
+    bits_[bit / 64] |= 1ULL << (bit % 64);
+  }
+
+  // Adds all keys of 'other' to this signature.
+  void Add(const Signature& other) {
+    for (int i = 0; i < SIGNATURE_WORDS; i++)
+      bits_[i] |= other.bits_[i];
+  }
+
+  bool Intersects(const Signature& other) const {
+    uint64 common = 0;
+    for (int i = 0; i < SIGNATURE_WORDS; i++)
+      common |= bits_[i] & other.bits_[i];
+    return common != 0;
+  }
+
+  uint64 bits_[SIGNATURE_WORDS];
+};
+
 // Txns can have five distinct status values:
 enum TxnStatus {
   INCOMPLETE = 0,   // Not yet executed
@@ -24,7 +63,11 @@ enum TxnStatus {
 class Txn {
  public:
   // Commit vote defauls to false. Only by calling "commit"
-  Txn() : status_(INCOMPLETE) {}
+  Txn()
+      : status_(INCOMPLETE), unique_id_(0), lock_requests_(NULL),
+        vll_prev_(NULL), vll_next_(NULL), vll_blocked_(false),
+        commit_dependencies_(0), occ_storage_(NULL), restarts_(0),
+        restart_time_(0) {}
   virtual ~Txn() {}
   virtual Txn * clone() const = 0;    // Virtual constructor (copying)
 
@@ -38,6 +81,17 @@ class Txn {
   // an error occurs.
   void CheckReadWriteSets();
 
+  // Fills in 'read_signature_' and 'write_signature_' from the readset and
+  // writeset.
+  void ComputeSignatures();
+
+  // Returns false if 'other' surely writes no record this txn reads or writes,
+  // judging by their signatures alone.
+  bool MayConflictWith(const Txn& other) const {
+    return other.write_signature_.Intersects(read_signature_) ||
+           other.write_signature_.Intersects(write_signature_);
+  }
+
  protected:
   // Copies the internals of this txn into a given transaction (i.e.
   // the readset, writeset, and so forth).  Be sure to modify this method
@@ -45,6 +99,8 @@ class Txn {
   void CopyTxnInternals(Txn* txn) const;
 
   friend class TxnProcessor;
+  friend class LockManagerA;
+  friend class LockManagerB;
 
   // Method to be used inside 'Execute()' function when reading records from
   // the database. If record corresponding with specified 'key' exists, sets
@@ -63,6 +119,16 @@ class Txn {
   // Note: Can ONLY be called from inside the 'Execute()' function.
   void Write(const Key& key, const Value& value);
 
+  // Method to be used inside 'Execute()' function by long-running txns to
+  // check, every now and then, whether a record they have read has been
+  // overwritten since. If so, the txn is bound to fail validation, so it should
+  // ABORT right away; the TxnProcessor then restarts it instead of reporting
+  // it aborted. Always returns true unless the TxnProcessor has enabled this
+  // check for the txn.
+  //
+  // Note: Can ONLY be called from inside the 'Execute()' function.
+  bool Revalidate();
+
   // Macro to be used inside 'Execute()' function when deciding to COMMIT.
   //
   // Note: Can ONLY be called from inside the 'Execute()' function.
@@ -88,6 +154,11 @@ class Txn {
   // Set of all keys that may be updated when executing the transaction.
   set<Key> writeset_;
 
+  // Signatures of 'readset_' and 'writeset_', computed when the txn is
+  // submitted.
+  Signature read_signature_;
+  Signature write_signature_;
+
   // Results of reads performed by the transaction.
   map<Key, Value> reads_;
 
@@ -100,8 +171,34 @@ class Txn {
   // Unique, monotonically increasing transaction ID, assigned by TxnProcessor.
   uint64 unique_id_;
 
-  // Start time (used for OCC).
-  double occ_start_time_;
+  // Versions of the records in the readset and writeset as of when the txn
+  // read them (used for OCC).
+  map<Key, uint64> occ_versions_;
+
+  // Lock requests (granted or not) the txn has made, newest first. Only the
+  // thread currently handling the txn links or unlinks them (used for LOCKING).
+  LockRequest *lock_requests_;
+
+  // Neighbours in the txn queue of the VLL lock manager, and whether the txn
+  // has to wait until it reaches the front of it (used for VLL).
+  Txn* vll_prev_;
+  Txn* vll_next_;
+  bool vll_blocked_;
+
+  // Number of txns whose writes this txn read after they released their locks
+  // early, and that have not been reported yet, plus one until the txn itself
+  // is done. The txn is only reported once this drops to zero (used for early
+  // lock release).
+  int commit_dependencies_;
+
+  // Storage that Revalidate() checks 'occ_versions_' against, or NULL if early
+  // aborts are disabled (used for OCC).
+  Storage* occ_storage_;
+
+  // Number of times the txn has failed validation and been restarted, and
+  // the time before which it is not run again (used for OCC and MVCC).
+  int restarts_;
+  double restart_time_;
 };
 
 #endif  // _TXN_H_
@@ -1,21 +1,90 @@
 
 #include "txn/txn_processor.h"
 #include <stdio.h>
+#include <algorithm>
 #include <set>
+#include <tr1/unordered_set>
+#include <utility>
 #include "txn/lock_manager.h"
 
 // Thread & queue counts for StaticThreadPool initialization.
 #define THREAD_COUNT 8
 
+// Maximum number of txn requests the CALVIN sequencer orders at a time.
+#define SEQUENCER_BATCH_SIZE 100
+
+// A txn that fails validation waits a random time of up to
+// RESTART_BACKOFF_BASE seconds before it runs again, doubling with each
+// restart up to RESTART_BACKOFF_MAX. After RESTART_ESCALATION_THRESHOLD
+// restarts it runs escalated, in a way that cannot fail validation.
+#define RESTART_BACKOFF_BASE 0.00005
+#define RESTART_BACKOFF_MAX 0.01
+#define RESTART_ESCALATION_THRESHOLD 8
+
+// Maximum number of completed txns the OCC scheduler validates at a time.
+#define OCC_VALIDATION_BATCH_SIZE 64
+
+// When true, OCC txns that fail validation are repaired instead of restarted
+// (see TxnProcessor::RefreshStaleReads()) until they reach
+// RESTART_ESCALATION_THRESHOLD.
+bool TXN_REPAIR = false;
+
+// Time in microseconds between two rounds of the MVCC garbage collector, and
+// the number of keys it collects in each round.
+#define MVCC_GC_INTERVAL 1000
+#define MVCC_GC_SWEEP_KEYS 1000
+
+// Time in microseconds between two advances of the SILO epoch, and between
+// two rounds of the SILO and TICTOC scheduler thread.
+#define SILO_EPOCH_INTERVAL 40000
+#define WORKER_SCHEDULER_INTERVAL 20
+
 bool LOGGING = false;
 
-TxnProcessor::TxnProcessor(CCMode mode)
-    : mode_(mode), tp_(THREAD_COUNT), next_unique_id_(1)
+// When true, txns in the locking modes release their locks early: read locks
+// as soon as their reads are done (all locks are already held by then, so
+// this is still two-phase), and write locks as soon as their writes are
+// applied, before the txn is reported to the client.
+bool EARLY_LOCK_RELEASE = false;
+
+// When true, long-running OCC txns check their reads while they run (see
+// Txn::Revalidate()), so that they can be restarted without running to the
+// end first.
+bool OCC_EARLY_ABORT = false;
+
+// Sets TID_LOCK_BIT in '*word' as soon as no other thread holds it.
+static void LockWord(volatile uint64 *word)
+{
+  int spins = 0;
+  while (true)
+  {
+    uint64 value = *word;
+    if ((value & TID_LOCK_BIT) == 0 &&
+        __sync_bool_compare_and_swap(word, value, value | TID_LOCK_BIT))
+      return;
+    SpinWait(&spins);
+  }
+}
+
+TxnProcessor::TxnProcessor(CCMode mode, DeadlockPolicy policy,
+                           int lock_escalation_threshold)
+    : mode_(mode),
+      ordered_locking_(mode == LOCKING && policy == ORDERED),
+      lock_escalation_threshold_(mode == VLL ? 0 : lock_escalation_threshold),
+      multiversion_(mode == MVCC || mode == SI || mode == SSI),
+      tp_(THREAD_COUNT),
+      stopped_(false),
+      epoch_(1),
+      next_unique_id_(1),
+      mvcc_low_watermark_(0),
+      active_set_closed_(false),
+      active_set_changed_(&active_set_mutex_),
+      validation_paused_(false),
+      restarts_(0),
+      escalated_restarts_(0)
 {
-  if (mode_ == LOCKING)
-    lm_ = new LockManagerA(&ready_txns_);
   // Create the storage
-  if (mode_ == MVCC)
+  if (multiversion_)
   {
     storage_ = new MVCCStorage();
   }
@@ -26,6 +95,13 @@ TxnProcessor::TxnProcessor(CCMode mode)
 
   storage_->InitStorage();
 
+  if (mode_ == LOCKING)
+    lm_ = new LockManagerA(&ready_txns_, policy);
+  else if (mode_ == CALVIN)
+    lm_ = new LockManagerA(&ready_txns_, ORDERED);
+  else if (mode_ == VLL)
+    lm_ = new LockManagerB(&ready_txns_, storage_);
+
   // Start 'RunScheduler()' running.
   cpu_set_t cpuset;
   pthread_attr_t attr;
@@ -36,8 +112,11 @@ TxnProcessor::TxnProcessor(CCMode mode)
     CPU_SET(i, &cpuset);
   }
   pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpuset);
-  pthread_t scheduler_;
-  pthread_create(&scheduler_, &attr, StartScheduler, reinterpret_cast<void *>(this));
+  pthread_create(&scheduler_thread_, &attr, StartScheduler, reinterpret_cast<void *>(this));
+  if (multiversion_)
+  {
+    pthread_create(&gc_thread_, &attr, StartGarbageCollector, reinterpret_cast<void *>(this));
+  }
 }
 
 void *TxnProcessor::StartScheduler(void *arg)
@@ -46,25 +125,65 @@ void *TxnProcessor::StartScheduler(void *arg)
   return NULL;
 }
 
+void *TxnProcessor::StartGarbageCollector(void *arg)
+{
+  reinterpret_cast<TxnProcessor *>(arg)->GarbageCollection();
+  return NULL;
+}
+
 TxnProcessor::~TxnProcessor()
 {
-  if (mode_ == LOCKING)
+  // Stop the scheduler thread, then let the workers finish their queued tasks,
+  // before tearing down the state both of them use.
+  stopped_ = true;
+  pthread_join(scheduler_thread_, NULL);
+  if (multiversion_)
+  {
+    pthread_join(gc_thread_, NULL);
+  }
+  tp_.Stop();
+
+  if (mode_ == LOCKING || mode_ == CALVIN || mode_ == VLL)
     delete lm_;
 
+  for (map<uint64, SSITxn *>::iterator it = ssi_txns_.begin();
+       it != ssi_txns_.end(); ++it)
+  {
+    delete it->second;
+  }
+
   delete storage_;
 }
 
 void TxnProcessor::NewTxnRequest(Txn *txn)
 {
+  txn->ComputeSignatures();
+
   // Atomically assign the txn a new number and add it to the incoming txn
   // requests queue.
   mutex_.Lock();
-  txn->unique_id_ = next_unique_id_;
-  next_unique_id_++;
-  txn_requests_.Push(txn);
+  SubmitTxn(txn);
   mutex_.Unlock();
 }
 
+void TxnProcessor::SubmitTxn(Txn *txn)
+{
+  AssignUniqueId(txn);
+  if (mode_ == SILO)
+  {
+    // Silo txns never go through the scheduler thread
+    tp_.RunTask(new Method<TxnProcessor, void, Txn *>(this, &TxnProcessor::SiloExecuteTxn, txn));
+  }
+  else if (mode_ == TICTOC)
+  {
+    tp_.RunTask(new Method<TxnProcessor, void, Txn *>(this, &TxnProcessor::TicTocExecuteTxn, txn));
+  }
+  else
+  {
+    txn_requests_.Push(txn);
+  }
+}
+
 Txn *TxnProcessor::GetTxnResult()
 {
   Txn *txn;
@@ -77,6 +196,21 @@ Txn *TxnProcessor::GetTxnResult()
   return txn;
 }
 
+int TxnProcessor::DeadlockAborts()
+{
+  return mode_ == LOCKING ? lm_->AbortCount() : 0;
+}
+
+int TxnProcessor::Restarts()
+{
+  return restarts_;
+}
+
+int TxnProcessor::EscalatedRestarts()
+{
+  return escalated_restarts_;
+}
+
 void TxnProcessor::RunScheduler()
 {
   switch (mode_)
@@ -90,15 +224,28 @@ void TxnProcessor::RunScheduler()
   case OCC:
     RunOCCScheduler();
     break;
+  case P_OCC:
+    RunOCCParallelScheduler();
+    break;
+  case SILO:
+  case TICTOC:
+    RunWorkerScheduler();
+    break;
   case MVCC:
+  case SI:
+  case SSI:
     RunMVCCScheduler();
+    break;
+  case CALVIN:
+  case VLL:
+    RunCalvinScheduler();
   }
 }
 
 void TxnProcessor::RunSerialScheduler()
 {
   Txn *txn;
-  while (tp_.Active())
+  while (!stopped_)
   {
     // Get next txn request.
     if (txn_requests_.Pop(&txn))
@@ -131,7 +278,7 @@ void TxnProcessor::RunSerialScheduler()
 void TxnProcessor::RunLockingScheduler()
 {
   Txn *txn;
-  while (tp_.Active())
+  while (!stopped_)
   {
     // Take transaction from requests
     if (txn_requests_.Pop(&txn))
@@ -143,91 +290,177 @@ void TxnProcessor::RunLockingScheduler()
           &TxnProcessor::ProcessTxn,
           txn));
     }
+
+    // parked transactions whose last lock (or, with ordered locking, whose
+    // next lock) has just been granted
+    while (ready_txns_.Pop(&txn))
+    {
+      tp_.RunTask(new Method<TxnProcessor, void, Txn *>(
+          this,
+          ordered_locking_ ? &TxnProcessor::ProcessTxn
+                           : &TxnProcessor::ExecuteLockedTxn,
+          txn));
+    }
   }
 }
 
-void TxnProcessor::ProcessTxn(Txn *txn)
+void TxnProcessor::RunCalvinScheduler()
 {
-  // we process the readset
-  for (set<Key>::iterator it = txn->readset_.begin();
-       it != txn->readset_.end(); ++it)
+  Txn *txn;
+  vector<Txn *> batch;
+  while (!stopped_)
   {
-    mutex_.Lock();
-    bool lockObtained = lm_->ReadLock(txn, *it);
-    mutex_.Unlock();
-    // we block the transaction while the lock is not obtained
-    if (LOGGING)
+    // the sequencer orders a batch of requests by unique_id_, then locks them
+    // one txn at a time on this thread
+    batch.clear();
+    while (batch.size() < SEQUENCER_BATCH_SIZE && txn_requests_.Pop(&txn))
     {
-      printf("[%ld] Acquiring read lock for readset for key: %ld \n", txn->unique_id_, *it);
+      batch.push_back(txn);
     }
-    while (!lockObtained)
+    sort(batch.begin(), batch.end(),
+         [](Txn *a, Txn *b) { return a->unique_id_ < b->unique_id_; });
+    for (vector<Txn *>::iterator it = batch.begin(); it != batch.end(); ++it)
     {
-      vector<Txn *> owners;
-      mutex_.Lock();
-      // we check the current owner of the lock
-      lm_->Status(*it, &owners);
-      if (owners.size() > 0)
+      if (AcquireLocks(*it))
       {
-        // if the owner is an "older" transaction / arrives later
-        if (owners[0]->unique_id_ < txn->unique_id_)
-        {
-          if (LOGGING)
-            printf("[%ld] Rolling back \n", txn->unique_id_);
-          // we rollback this transaction at once
-          this->ReleaseLocks(txn);
-          it = txn->readset_.begin();
-          mutex_.Unlock();
-          break;
-        }
+        tp_.RunTask(new Method<TxnProcessor, void, Txn *>(
+            this,
+            &TxnProcessor::ExecuteLockedTxn,
+            *it));
       }
-      lockObtained = lm_->ReadLock(txn, *it);
-      mutex_.Unlock();
-    };
-    if (LOGGING)
+    }
+
+    // parked transactions whose last lock has just been granted
+    while (ready_txns_.Pop(&txn))
     {
-      printf("[%ld] Successfully acquired read lock [%ld]\n", txn->unique_id_, *it);
+      tp_.RunTask(new Method<TxnProcessor, void, Txn *>(
+          this,
+          &TxnProcessor::ExecuteLockedTxn,
+          txn));
     }
   }
-  // now we process the writesets
-  for (set<Key>::iterator it = txn->writeset_.begin();
-       it != txn->writeset_.end(); ++it)
+}
+
+void TxnProcessor::ProcessTxn(Txn *txn)
+{
+  if (AcquireLocks(txn))
+  {
+    ExecuteLockedTxn(txn);
+  }
+}
+
+bool TxnProcessor::AcquireLocks(Txn *txn)
+{
+  // with hierarchical locking every record lock is covered by an intention
+  // lock on its granule, unless the txn is too wide, in which case it locks
+  // its granules in S or X (or SIX, if it only writes some of their records)
+  bool hierarchical = lock_escalation_threshold_ > 0;
+  bool escalate = hierarchical &&
+                  txn->readset_.size() + txn->writeset_.size() >
+                      static_cast<size_t>(lock_escalation_threshold_);
+  map<Key, LockMode> granules;
+  if (hierarchical)
+  {
+    for (set<Key>::iterator it = txn->readset_.begin();
+         it != txn->readset_.end(); ++it)
+    {
+      granules[*it - *it % LOCK_GRANULE_SIZE] = escalate ? SHARED : INTENTION_SHARED;
+    }
+    for (set<Key>::iterator it = txn->writeset_.begin();
+         it != txn->writeset_.end(); ++it)
+    {
+      LockMode &mode = granules[*it - *it % LOCK_GRANULE_SIZE];
+      if (!escalate)
+        mode = INTENTION_EXCLUSIVE;
+      else if (mode == SHARED || mode == SHARED_INTENTION_EXCLUSIVE)
+        mode = SHARED_INTENTION_EXCLUSIVE;
+      else
+        mode = EXCLUSIVE;
+    }
+  }
+
+  // an escalated txn only locks the records it writes in SIX granules
+  static const set<Key> no_keys;
+  const set<Key> *readset = escalate ? &no_keys : &txn->readset_;
+  const set<Key> *writeset = &txn->writeset_;
+  set<Key> six_writes;
+  if (escalate)
+  {
+    for (set<Key>::iterator it = txn->writeset_.begin();
+         it != txn->writeset_.end(); ++it)
+    {
+      if (granules[*it - *it % LOCK_GRANULE_SIZE] == SHARED_INTENTION_EXCLUSIVE)
+        six_writes.insert(*it);
+    }
+    writeset = &six_writes;
+  }
+
+  if (ordered_locking_)
+  {
+    return lm_->AcquireAll(txn, *readset, *writeset, granules);
+  }
+
+  // we request every lock up front; requests that cannot be granted yet stay
+  // queued in the lock manager instead of being retried
+  lm_->BeginAcquire(txn);
+  for (map<Key, LockMode>::iterator it = granules.begin();
+       it != granules.end(); ++it)
   {
     if (LOGGING)
     {
-      printf("[%ld] Acquiring write lock for writeset for key: %ld\n", txn->unique_id_, *it);
+      printf("[%ld] Acquiring lock in mode %d for granule: %ld\n", txn->unique_id_, it->second, it->first / LOCK_GRANULE_SIZE);
     }
-    mutex_.Lock();
-    bool lockObtained = lm_->WriteLock(txn, *it);
-    mutex_.Unlock();
-    while (!lockObtained) // we block the process while the lock is not obtained
+    lm_->GranuleLock(txn, it->first, it->second);
+  }
+  for (set<Key>::const_iterator it = readset->begin(); it != readset->end(); ++it)
+  {
+    if (LOGGING)
     {
-      mutex_.Lock();
-      vector<Txn *> owners;
-      lm_->Status(*it, &owners);
-      // we check the current owner of the lock
-      if (owners.size() > 0)
-      {
-        if (owners[0]->unique_id_ < txn->unique_id_)
-        {
-          // rollback if the owner is a younger transaction
-          if (LOGGING)
-            printf("[%ld] Rolling back \n", txn->unique_id_);
-          this->ReleaseLocks(txn);
-          it = txn->writeset_.begin();
-          mutex_.Unlock();
-          break;
-        }
-      }
-      lockObtained = lm_->WriteLock(txn, *it);
-      mutex_.Unlock();
+      printf("[%ld] Acquiring read lock for readset for key: %ld \n", txn->unique_id_, *it);
     }
+    lm_->ReadLock(txn, *it);
+  }
+  for (set<Key>::const_iterator it = writeset->begin(); it != writeset->end(); ++it)
+  {
     if (LOGGING)
     {
-      printf("[%ld] Successfully acquired write lock [%ld]\n", txn->unique_id_, *it);
+      printf("[%ld] Acquiring write lock for writeset for key: %ld\n", txn->unique_id_, *it);
     }
+    lm_->WriteLock(txn, *it);
+  }
+
+  // if some request is still pending the txn parks here and this thread is
+  // free to do something else; the lock manager puts the txn on ready_txns_
+  // once its last lock is granted
+  return lm_->EndAcquire(txn);
+}
+
+void TxnProcessor::ExecuteLockedTxn(Txn *txn)
+{
+  if (!ordered_locking_ && lm_->Aborted(txn))
+  {
+    // the lock manager aborted this txn to prevent a deadlock, so we roll it
+    // back and restart it, keeping its unique_id_ so that it gets older (and
+    // eventually wins) instead of starving
+    if (LOGGING)
+      printf("[%ld] Rolling back \n", txn->unique_id_);
+    this->ReleaseLocks(txn);
+    txn_requests_.Push(txn);
+    return;
   }
+
   // at this point we have obtained all the lock for the txn we need so we can execute it
-  this->ExecuteTxn(txn);
+  if (EARLY_LOCK_RELEASE)
+  {
+    AddCommitDependencies(txn);
+  }
+  this->ReadTxn(txn);
+  if (EARLY_LOCK_RELEASE && mode_ != VLL)
+  {
+    // nothing is read after this point; VLL can only release all locks at once
+    lm_->ReleaseShared(txn);
+  }
+  txn->Run();
   // Commit/abort txn according to program logic's commit/abort decision.
 
   TxnStatus status = txn->Status();
@@ -239,79 +472,106 @@ void TxnProcessor::ProcessTxn(Txn *txn)
       printf("[!] Changing the status of transaction %ld to COMMITED\n", txn->unique_id_);
     }
     ApplyWrites(txn);
-    txn->status_ = COMMITTED;
-  }
-  else if (status == COMPLETED_A)
-  {
-    txn->status_ = ABORTED;
+    if (EARLY_LOCK_RELEASE && !txn->writes_.empty())
+    {
+      // from here on other txns may read our writes before we are reported
+      unreported_mutex_.Lock();
+      unreported_txns_[txn->unique_id_];
+      unreported_mutex_.Unlock();
+    }
   }
-  else
+  else if (status != COMPLETED_A)
   {
     // Invalid TxnStatus!
     DIE("Completed Txn has invalid TxnStatus: " << status);
   }
 
   // Release read locks.
-  mutex_.Lock();
   this->ReleaseLocks(txn);
-  mutex_.Unlock();
 
   // Return result to client.
-  txn_results_.Push(txn);
+  if (EARLY_LOCK_RELEASE)
+  {
+    ReportTxn(txn);
+  }
+  else
+  {
+    txn->status_ = status == COMPLETED_C ? COMMITTED : ABORTED;
+    txn_results_.Push(txn);
+  }
   if (LOGGING)
   {
     printf("[!] Finished pusing to client\n");
   }
 }
 
-void TxnProcessor::ReleaseLocks(Txn *txn)
+void TxnProcessor::AddCommitDependencies(Txn *txn)
 {
-  for (set<Key>::iterator it = txn->readset_.begin();
-       it != txn->readset_.end(); ++it)
+  txn->commit_dependencies_ = 1;
+  unreported_mutex_.Lock();
+  if (!unreported_txns_.empty())
   {
-    if (LOGGING)
+    for (int i = 0; i < 2; i++)
     {
-      printf("[%ld] Releasing lock: %ld \n", txn->unique_id_, *it);
+      const set<Key> &keys = i == 0 ? txn->readset_ : txn->writeset_;
+      for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+      {
+        auto writer = unreported_txns_.find(storage_->GetRecord(*it)->writer_);
+        if (writer != unreported_txns_.end())
+        {
+          writer->second.push_back(txn);
+          txn->commit_dependencies_++;
+        }
+      }
     }
-    lm_->Release(txn, *it);
   }
+  unreported_mutex_.Unlock();
+}
 
-  for (set<Key>::iterator it = txn->writeset_.begin();
-       it != txn->writeset_.end(); ++it)
+void TxnProcessor::ReportTxn(Txn *txn)
+{
+  unreported_mutex_.Lock();
+  if (--txn->commit_dependencies_ > 0)
   {
-    if (LOGGING)
+    // the last txn it depends on reports it
+    unreported_mutex_.Unlock();
+    return;
+  }
+  vector<Txn *> reportable(1, txn);
+  while (!reportable.empty())
+  {
+    Txn *next = reportable.back();
+    reportable.pop_back();
+    auto dependents = unreported_txns_.find(next->unique_id_);
+    if (dependents != unreported_txns_.end())
     {
-      printf("[%ld] Releasing lock: %ld \n", txn->unique_id_, *it);
+      for (auto it = dependents->second.begin(); it != dependents->second.end(); ++it)
+      {
+        if (--(*it)->commit_dependencies_ == 0)
+        {
+          reportable.push_back(*it);
+        }
+      }
+      unreported_txns_.erase(dependents);
     }
-    lm_->Release(txn, *it);
+    next->status_ = next->status_ == COMPLETED_C ? COMMITTED : ABORTED;
+    txn_results_.Push(next);
   }
+  unreported_mutex_.Unlock();
 }
 
-void TxnProcessor::ExecuteTxn(Txn *txn)
+void TxnProcessor::ReleaseLocks(Txn *txn)
 {
-
-  // Get the start time
-  txn->occ_start_time_ = GetTime();
-
-  // Read everything in from readset.
-  for (set<Key>::iterator it = txn->readset_.begin();
-       it != txn->readset_.end(); ++it)
+  if (LOGGING)
   {
-    // Save each read result iff record exists in storage.
-    Value result;
-    if (storage_->Read(*it, &result))
-      txn->reads_[*it] = result;
+    printf("[%ld] Releasing locks\n", txn->unique_id_);
   }
+  lm_->ReleaseAll(txn);
+}
 
-  // Also read everything in from writeset.
-  for (set<Key>::iterator it = txn->writeset_.begin();
-       it != txn->writeset_.end(); ++it)
-  {
-    // Save each read result iff record exists in storage.
-    Value result;
-    if (storage_->Read(*it, &result))
-      txn->reads_[*it] = result;
-  }
+void TxnProcessor::ExecuteTxn(Txn *txn)
+{
+  OCCReadTxn(txn);
 
   // Execute txn's program logic.
   txn->Run();
@@ -324,6 +584,43 @@ void TxnProcessor::ExecuteTxn(Txn *txn)
   }
 }
 
+void TxnProcessor::ReadTxn(Txn *txn)
+{
+  // Read everything in from readset, and also everything in from writeset.
+  for (int i = 0; i < 2; i++)
+  {
+    const set<Key> &keys = i == 0 ? txn->readset_ : txn->writeset_;
+    for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      // Save each read result iff record exists in storage.
+      Value result;
+      if (storage_->Read(*it, &result, txn->unique_id_))
+        txn->reads_[*it] = result;
+    }
+  }
+}
+
+void TxnProcessor::OCCReadTxn(Txn *txn)
+{
+  // the versions are read before the values, so a write that lands in between
+  // shows up as a changed version during validation
+  for (int i = 0; i < 2; i++)
+  {
+    const set<Key> &keys = i == 0 ? txn->readset_ : txn->writeset_;
+    for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      txn->occ_versions_[*it] = storage_->RecordVersion(*it);
+    }
+  }
+  __sync_synchronize();
+  ReadTxn(txn);
+
+  if (OCC_EARLY_ABORT && mode_ != SERIAL)
+  {
+    txn->occ_storage_ = storage_;
+  }
+}
+
 void TxnProcessor::ApplyWrites(Txn *txn)
 {
   // Write buffered writes out to storage.
@@ -334,154 +631,873 @@ void TxnProcessor::ApplyWrites(Txn *txn)
   }
 }
 
-void TxnProcessor::RunOCCScheduler()
+void TxnProcessor::RefreshStaleReads(Txn *txn)
 {
-  // Serial OCC/Validation-Based Protocol
-  Txn *txn;
-
-  // check for active transaction requests in pool
-  while (tp_.Active())
+  // only records that changed since we read them, and the ones whose read
+  // results our own writes have overwritten, need to be read again
+  for (map<Key, uint64>::iterator it = txn->occ_versions_.begin();
+       it != txn->occ_versions_.end(); ++it)
   {
-    // get next new transaction request
-    if (txn_requests_.Pop(&txn))
+    uint64 version = storage_->RecordVersion(it->first);
+    if (version == it->second && txn->writes_.count(it->first) == 0)
     {
-      // transaction is pending, pass to exec thread
-      txn->occ_start_time_ = GetTime();
-
-      tp_.RunTask(new Method<TxnProcessor, void, Txn *>(this, &TxnProcessor::ExecuteTxn, txn));
+      continue;
     }
+    it->second = version;
+    __sync_synchronize();
+    Value result;
+    if (storage_->Read(it->first, &result))
+      txn->reads_[it->first] = result;
+    else
+      txn->reads_.erase(it->first);
+  }
+  txn->writes_.clear();
+  txn->status_ = INCOMPLETE;
+}
 
-    // check completed transactions (not committed/aborted)
-    while (completed_txns_.Pop(&txn))
-    {
-      bool validationFailed = false;
-
-      // validation phase, check for transaction validity
-      // check timestamp for each record whose key appears in the txn s read and write sets
+void TxnProcessor::RepairTxn(Txn *txn)
+{
+  RefreshStaleReads(txn);
+  txn->Run();
 
-      // check readset
-      for (auto itr = txn->readset_.begin(); itr != txn->readset_.end(); itr++)
-      {
-        double recordUpdateTime = storage_->Timestamp(*itr);
+  // Hand the txn back to the RunScheduler thread for validation.
+  completed_txns_.Push(txn);
+}
 
-        // check if the record was last updated AFTER this transaction s start time
-        // valid condition: data_modify_time < txn_start_time
-        if (recordUpdateTime > txn->occ_start_time_)
-        {
-          // failed validation
-          validationFailed = true;
-          break;
-        }
-      }
+void TxnProcessor::RestartTxn(Txn *txn)
+{
+  // cleanup txn
+  txn->reads_.clear();
+  txn->writes_.clear();
+  txn->status_ = INCOMPLETE;
 
-      // check writeset
-      for (auto itr = txn->writeset_.begin(); itr != txn->writeset_.end(); itr++)
-      {
-        double recordUpdateTime = storage_->Timestamp(*itr);
+  // back off for longer the more often the txn has lost, so that hot keys do
+  // not cause restart storms
+  double backoff = RESTART_BACKOFF_BASE * (1 << std::min(txn->restarts_, 20));
+  txn->restarts_++;
+  txn->restart_time_ = GetTime() + RandomDouble(std::min(backoff, RESTART_BACKOFF_MAX));
+  __sync_fetch_and_add(&restarts_, 1);
+  restarted_txns_.Push(txn);
+}
 
-        // check if the record was last updated AFTER this transaction s start time
-        // valid condition: data_modify_time < txn_start_time
-        if (recordUpdateTime > txn->occ_start_time_)
-        {
-          // failed validation
-          validationFailed = true;
-          break;
-        }
-      }
+void TxnProcessor::ScheduleRestarts()
+{
+  Txn *txn;
+  while (restarted_txns_.Pop(&txn))
+  {
+    restart_queue_.push(std::make_pair(txn->restart_time_, txn));
+  }
+  if (restart_queue_.empty())
+  {
+    return;
+  }
 
-      // DECISION: abort/commit
-      if (validationFailed)
+  double now = GetTime();
+  while (!restart_queue_.empty() && restart_queue_.top().first <= now)
+  {
+    txn = restart_queue_.top().second;
+    if (txn->restarts_ >= RESTART_ESCALATION_THRESHOLD)
+    {
+      if (validation_paused_)
       {
-        // ABORT transaction, RESTART transaction
-        // cleanup txn
-        txn->reads_.clear();
-        txn->writes_.clear();
-        txn->status_ = INCOMPLETE;
-
-        // restart txn
-        mutex_.Lock();
-        txn->unique_id_ = next_unique_id_;
-        next_unique_id_++;
-        txn_requests_.Push(txn);
-        mutex_.Unlock();
+        // one escalated OCC txn at a time
+        break;
       }
-      else
+      restart_queue_.pop();
+      escalated_restarts_++;
+      if (mode_ == OCC)
       {
-        // COMMIT
-        // write to storage
-        txn->status_ = COMPLETED_C;
-        ApplyWrites(txn);
-
-        // set as commited, push to result
-        txn->status_ = COMMITTED;
-        txn_results_.Push(txn);
+        // only the scheduler thread applies writes in OCC mode, so it stops
+        // doing so until the escalated txn is done
+        validation_paused_ = true;
       }
+      tp_.RunTask(new Method<TxnProcessor, void, Txn *>(this, &TxnProcessor::ExecuteEscalatedTxn, txn));
+      continue;
     }
+    restart_queue_.pop();
+
+    // restart txn as a new request
+    mutex_.Lock();
+    SubmitTxn(txn);
+    mutex_.Unlock();
   }
 }
 
-void TxnProcessor::MVCCExecuteTxn(Txn* txn) {
-  // Read all necessary data for this transaction from storage 
-  //    (Note that unlike the version of MVCC from class, you should lock the key before each read)
-  // read for readset
-  for (auto read_key : txn->readset_) {
-    Value result;
-    storage_->Lock(read_key);
-    if (storage_->Read(read_key, &result)) {
-      txn->reads_[read_key] = result;
-    }
-    storage_->Unlock(read_key);
+void TxnProcessor::ExecuteEscalatedTxn(Txn *txn)
+{
+  if (multiversion_)
+  {
+    // keep other writers off the txn's keys, while readers go on as usual,
+    // and run it again at a new timestamp until it passes. Nothing can make
+    // it fail then, except for an SSI dangerous structure with readers, so
+    // it backs off between attempts in SSI mode. It holds its writeset only
+    // while it checks and installs its writes.
+    set<Key> keys(txn->readset_);
+    keys.insert(txn->writeset_.begin(), txn->writeset_.end());
+    for (set<Key>::iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      storage_->Reserve(*it);
+    }
+    double backoff = RESTART_BACKOFF_BASE;
+    while (true)
+    {
+      txn->reads_.clear();
+      txn->writes_.clear();
+      txn->status_ = INCOMPLETE;
+      mutex_.Lock();
+      AssignUniqueId(txn);
+      mutex_.Unlock();
+      if (MVCCTryTxn(txn, true))
+        break;
+      usleep(RandomDouble(backoff) * 1e6);
+      backoff = std::min(2 * backoff, RESTART_BACKOFF_MAX);
+    }
+    for (set<Key>::iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      storage_->Unreserve(*it);
+    }
+    return;
+  }
+
+  // nothing can invalidate the txn's reads, so it need not check them
+  txn->occ_storage_ = NULL;
+
+  set<Key> keys;
+  if (mode_ == P_OCC)
+  {
+    // keep new txns from validating until the ones that are validating are
+    // done and we have committed
+    active_set_mutex_.Lock();
+    while (active_set_closed_)
+    {
+      active_set_changed_.WaitLocked();
+    }
+    active_set_closed_ = true;
+    while (active_set_.Size() > 0)
+    {
+      active_set_changed_.WaitLocked();
+    }
+    active_set_mutex_.Unlock();
+  }
+  else if (mode_ == SILO || mode_ == TICTOC)
+  {
+    // lock all of the txn's records in key order, like the writesets of other
+    // txns, so that none of them can change until we have committed
+    keys.insert(txn->readset_.begin(), txn->readset_.end());
+    keys.insert(txn->writeset_.begin(), txn->writeset_.end());
+    for (set<Key>::iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      Record *record = storage_->GetRecord(*it);
+      LockWord(mode_ == SILO ? &record->tid_ : &record->wts_);
+    }
+  }
+
+  ReadTxn(txn);
+  txn->Run();
+  if (txn->Status() == COMPLETED_C)
+  {
+    ApplyWrites(txn);
+    txn->status_ = COMMITTED;
+  }
+  else
+  {
+    txn->status_ = ABORTED;
+  }
+
+  if (mode_ == SILO || mode_ == TICTOC)
+  {
+    UnlockEscalatedRecords(txn, keys);
+  }
+  else if (mode_ == OCC)
+  {
+    __sync_synchronize();
+    validation_paused_ = false;
+  }
+  else if (mode_ == P_OCC)
+  {
+    active_set_mutex_.Lock();
+    active_set_closed_ = false;
+    active_set_changed_.BroadcastLocked();
+    active_set_mutex_.Unlock();
+  }
+  txn_results_.Push(txn);
+}
+
+void TxnProcessor::RunOCCScheduler()
+{
+  // Serial OCC/Validation-Based Protocol
+  Txn *txn;
+  vector<Txn *> batch;
+  vector<Txn *> committed;
+  unordered_set<Key> batch_writes;
+  Signature batch_signature;
+
+  // check for active transaction requests in pool
+  while (!stopped_)
+  {
+    // get next new transaction request
+    if (txn_requests_.Pop(&txn))
+    {
+      // transaction is pending, pass to exec thread
+      tp_.RunTask(new Method<TxnProcessor, void, Txn *>(this, &TxnProcessor::ExecuteTxn, txn));
+    }
+    ScheduleRestarts();
+    if (validation_paused_)
+    {
+      // an escalated txn is running
+      continue;
+    }
+
+    // check completed transactions (not committed/aborted), a batch at a time
+    batch.clear();
+    while (batch.size() < OCC_VALIDATION_BATCH_SIZE && completed_txns_.Pop(&txn))
+    {
+      batch.push_back(txn);
+    }
+    if (batch.empty())
+    {
+      continue;
+    }
+
+    // validation phase, in batch order: a txn fails if a record it used was
+    // updated AFTER it read it, either in storage or by a txn that passed
+    // earlier in this batch (whose writes are not applied yet)
+    batch_writes.clear();
+    batch_signature.Clear();
+    committed.clear();
+    for (vector<Txn *>::iterator t = batch.begin(); t != batch.end(); ++t)
+    {
+      txn = *t;
+      bool validationFailed = false;
+      bool batchConflict = batch_signature.Intersects(txn->read_signature_) ||
+                           batch_signature.Intersects(txn->write_signature_);
+      for (map<Key, uint64>::iterator itr = txn->occ_versions_.begin();
+           itr != txn->occ_versions_.end(); itr++)
+      {
+        // valid condition: current version == version read
+        if (storage_->RecordVersion(itr->first) != itr->second ||
+            (batchConflict && batch_writes.count(itr->first) > 0))
+        {
+          // failed validation
+          validationFailed = true;
+          break;
+        }
+      }
+
+      // DECISION: abort/commit
+      if (validationFailed)
+      {
+        // ABORT transaction, then REPAIR or RESTART it
+        if (TXN_REPAIR && txn->restarts_ < RESTART_ESCALATION_THRESHOLD)
+        {
+          txn->restarts_++;
+          __sync_fetch_and_add(&restarts_, 1);
+          tp_.RunTask(new Method<TxnProcessor, void, Txn *>(this, &TxnProcessor::RepairTxn, txn));
+        }
+        else
+        {
+          RestartTxn(txn);
+        }
+      }
+      else
+      {
+        for (map<Key, Value>::iterator itr = txn->writes_.begin();
+             itr != txn->writes_.end(); itr++)
+        {
+          batch_writes.insert(itr->first);
+        }
+        batch_signature.Add(txn->write_signature_);
+        committed.push_back(txn);
+      }
+    }
+
+    // COMMIT the txns that passed: write to storage, then set as commited and
+    // push to result
+    for (vector<Txn *>::iterator t = committed.begin(); t != committed.end(); ++t)
+    {
+      (*t)->status_ = COMPLETED_C;
+      ApplyWrites(*t);
+    }
+    for (vector<Txn *>::iterator t = committed.begin(); t != committed.end(); ++t)
+    {
+      (*t)->status_ = COMMITTED;
+      txn_results_.Push(*t);
+    }
+  }
+}
+
+void TxnProcessor::RunOCCParallelScheduler()
+{
+  // OCC with parallel validation: the scheduler thread only hands out new txns,
+  // the workers validate and commit them
+  Txn *txn;
+  while (!stopped_)
+  {
+    if (txn_requests_.Pop(&txn))
+    {
+      tp_.RunTask(new Method<TxnProcessor, void, Txn *>(this, &TxnProcessor::ExecuteTxnParallel, txn));
+    }
+    ScheduleRestarts();
+  }
+}
+
+void TxnProcessor::ExecuteTxnParallel(Txn *txn)
+{
+  OCCReadTxn(txn);
+  txn->Run();
+
+  while (true)
+  {
+    // join the validating txns; any txn that left the set before this point
+    // has already applied its writes, so the version checks below cover it.
+    // The txns in the set are checked for writes to anything we use while we
+    // hold the mutex, since they may be reported and freed once they leave.
+    bool valid = true;
+    active_set_mutex_.Lock();
+    while (active_set_closed_)
+    {
+      // an escalated txn is running
+      active_set_changed_.WaitLocked();
+    }
+    set<Txn *> active = active_set_.GetSet();
+    for (set<Txn *>::iterator t = active.begin(); t != active.end() && valid; ++t)
+    {
+      if (!txn->MayConflictWith(**t))
+      {
+        continue;
+      }
+      for (set<Key>::iterator it = (*t)->writeset_.begin();
+           it != (*t)->writeset_.end(); ++it)
+      {
+        if (txn->readset_.count(*it) > 0 || txn->writeset_.count(*it) > 0)
+        {
+          valid = false;
+          break;
+        }
+      }
+    }
+    active_set_.Insert(txn);
+    active_set_mutex_.Unlock();
+
+    // check for txns that committed since we read
+    for (int i = 0; i < 2 && valid; i++)
+    {
+      const set<Key> &keys = i == 0 ? txn->readset_ : txn->writeset_;
+      for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+      {
+        if (storage_->RecordVersion(*it) != txn->occ_versions_[*it])
+        {
+          valid = false;
+          break;
+        }
+      }
+    }
+
+    if (valid)
+    {
+      if (txn->Status() == COMPLETED_C)
+      {
+        ApplyWrites(txn);
+        txn->status_ = COMMITTED;
+      }
+      else
+      {
+        txn->status_ = ABORTED;
+      }
+      LeaveActiveSet(txn);
+      txn_results_.Push(txn);
+      return;
+    }
+
+    LeaveActiveSet(txn);
+    if (!TXN_REPAIR || txn->restarts_ >= RESTART_ESCALATION_THRESHOLD)
+    {
+      RestartTxn(txn);
+      return;
+    }
+
+    // repair the txn in place and validate it again
+    txn->restarts_++;
+    __sync_fetch_and_add(&restarts_, 1);
+    RefreshStaleReads(txn);
+    txn->Run();
+  }
+}
+
+void TxnProcessor::LeaveActiveSet(Txn *txn)
+{
+  active_set_mutex_.Lock();
+  active_set_.Erase(txn);
+  if (active_set_closed_)
+  {
+    // an escalated txn may be waiting for the set to drain
+    active_set_changed_.BroadcastLocked();
+  }
+  active_set_mutex_.Unlock();
+}
+
+void TxnProcessor::RunWorkerScheduler()
+{
+  double next_epoch = GetTime() + SILO_EPOCH_INTERVAL / 1e6;
+  while (!stopped_)
+  {
+    ScheduleRestarts();
+    if (mode_ == SILO && GetTime() >= next_epoch)
+    {
+      __sync_fetch_and_add(&epoch_, 1);
+      next_epoch += SILO_EPOCH_INTERVAL / 1e6;
+    }
+    usleep(WORKER_SCHEDULER_INTERVAL);
+  }
+}
+
+void TxnProcessor::UnlockEscalatedRecords(Txn *txn, const set<Key> &keys)
+{
+  if (mode_ == SILO)
+  {
+    // the new TID comes after every TID the txn has seen, and publishing it
+    // releases the records it wrote
+    uint64 tid = epoch_ << TID_EPOCH_SHIFT;
+    for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      tid = std::max<uint64>(tid, storage_->GetRecord(*it)->tid_ & ~TID_LOCK_BIT);
+    }
+    tid++;
+    __sync_synchronize();
+    for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      Record *record = storage_->GetRecord(*it);
+      if (txn->writes_.count(*it) > 0 && txn->Status() == COMMITTED)
+        record->tid_ = tid;
+      else
+        record->tid_ &= ~TID_LOCK_BIT;
+    }
+    return;
+  }
+
+  // TICTOC: the commit timestamp comes after every version the txn read and
+  // every read of the records it wrote. Every version it read stays valid up
+  // to it.
+  uint64 commit_ts = 0;
+  for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+  {
+    Record *record = storage_->GetRecord(*it);
+    commit_ts = std::max<uint64>(commit_ts, record->wts_ & ~TID_LOCK_BIT);
+    if (txn->writes_.count(*it) > 0)
+      commit_ts = std::max<uint64>(commit_ts, record->rts_ + 1);
+  }
+  for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+  {
+    Record *record = storage_->GetRecord(*it);
+    if (txn->writes_.count(*it) > 0 && txn->Status() == COMMITTED)
+    {
+      record->rts_ = commit_ts;
+      __sync_synchronize();
+      record->wts_ = commit_ts;
+    }
+    else
+    {
+      if (record->rts_ < commit_ts)
+        record->rts_ = commit_ts;
+      __sync_synchronize();
+      record->wts_ &= ~TID_LOCK_BIT;
+    }
+  }
+}
+
+void TxnProcessor::SiloExecuteTxn(Txn *txn)
+{
+  // largest TID this worker has committed, so its own commits stay ordered
+  static __thread uint64 last_tid = 0;
+
+  map<Key, uint64> read_tids;
+  vector<Record *> locked;
+  // read phase: take a consistent snapshot of each record and its TID
+  for (int i = 0; i < 2; i++)
+  {
+    const set<Key> &keys = i == 0 ? txn->readset_ : txn->writeset_;
+    for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      Record *record = storage_->GetRecord(*it);
+      uint64 tid;
+      Value value;
+      bool exists;
+      int spins = 0;
+      while (true)
+      {
+        tid = record->tid_;
+        __sync_synchronize();
+        value = record->value_;
+        exists = record->version_ != 0;
+        __sync_synchronize();
+        if ((tid & TID_LOCK_BIT) == 0 && tid == record->tid_)
+          break;
+        SpinWait(&spins);
+      }
+      read_tids[*it] = tid;
+      if (exists)
+        txn->reads_[*it] = value;
+    }
+  }
+
+  txn->Run();
+
+  // lock the writeset in key order, so committing txns cannot deadlock. A
+  // txn that chose to abort writes nothing, but must still check that it
+  // decided on reads that were valid.
+  bool commit = txn->Status() == COMPLETED_C;
+  for (set<Key>::iterator it = txn->writeset_.begin();
+       commit && it != txn->writeset_.end(); ++it)
+  {
+    Record *record = storage_->GetRecord(*it);
+    LockWord(&record->tid_);
+    locked.push_back(record);
+  }
+  __sync_synchronize();
+  uint64 epoch = epoch_;
+
+  // validation: every record we read must still carry the TID we saw, and
+  // must not be locked by another committing txn
+  bool valid = true;
+  uint64 tid = std::max(last_tid, epoch << TID_EPOCH_SHIFT);
+  for (map<Key, uint64>::iterator it = read_tids.begin();
+       it != read_tids.end(); ++it)
+  {
+    uint64 current = storage_->GetRecord(it->first)->tid_;
+    if ((current & ~TID_LOCK_BIT) != it->second ||
+        ((current & TID_LOCK_BIT) != 0 &&
+         (!commit || txn->writeset_.count(it->first) == 0)))
+    {
+      valid = false;
+      break;
+    }
+    tid = std::max(tid, it->second);
+  }
+
+  if (valid && !commit)
+  {
+    txn->status_ = ABORTED;
+    txn_results_.Push(txn);
+    return;
+  }
+  if (valid)
+  {
+    // write phase: install the writes, then publish the new TID, which also
+    // releases the lock
+    tid++;
+    last_tid = tid;
+    for (map<Key, Value>::iterator it = txn->writes_.begin();
+         it != txn->writes_.end(); ++it)
+    {
+      Record *record = storage_->GetRecord(it->first);
+      record->value_ = it->second;
+      record->version_++;
+    }
+    __sync_synchronize();
+    for (vector<Record *>::iterator it = locked.begin(); it != locked.end(); ++it)
+    {
+      (*it)->tid_ = tid;
+    }
+    txn->status_ = COMMITTED;
+    txn_results_.Push(txn);
+    return;
+  }
+
+  // release the writeset unchanged, and run the txn again after a backoff
+  for (vector<Record *>::iterator it = locked.begin(); it != locked.end(); ++it)
+  {
+    (*it)->tid_ &= ~TID_LOCK_BIT;
+  }
+  RestartTxn(txn);
+}
+
+void TxnProcessor::TicTocExecuteTxn(Txn *txn)
+{
+  map<Key, std::pair<uint64, uint64> > read_ts;
+  vector<Record *> locked;
+  // read phase: take a consistent snapshot of each record and its wts/rts
+  for (int i = 0; i < 2; i++)
+  {
+    const set<Key> &keys = i == 0 ? txn->readset_ : txn->writeset_;
+    for (set<Key>::const_iterator it = keys.begin(); it != keys.end(); ++it)
+    {
+      Record *record = storage_->GetRecord(*it);
+      uint64 wts, rts;
+      Value value;
+      bool exists;
+      int spins = 0;
+      while (true)
+      {
+        wts = record->wts_;
+        __sync_synchronize();
+        rts = record->rts_;
+        value = record->value_;
+        exists = record->version_ != 0;
+        __sync_synchronize();
+        if ((wts & TID_LOCK_BIT) == 0 && wts == record->wts_)
+          break;
+        SpinWait(&spins);
+      }
+      read_ts[*it] = std::make_pair(wts, rts);
+      if (exists)
+        txn->reads_[*it] = value;
+    }
+  }
+
+  txn->Run();
+
+  // lock the writeset in key order, so committing txns cannot deadlock. A
+  // txn that chose to abort writes nothing, but must still check that its
+  // reads were all valid at one timestamp.
+  bool commit = txn->Status() == COMPLETED_C;
+  for (set<Key>::iterator it = txn->writeset_.begin();
+       commit && it != txn->writeset_.end(); ++it)
+  {
+    Record *record = storage_->GetRecord(*it);
+    LockWord(&record->wts_);
+    locked.push_back(record);
+  }
+
+  // the commit timestamp must come after every version we read, and after
+  // every read of the records we overwrite
+  uint64 commit_ts = 0;
+  for (map<Key, std::pair<uint64, uint64> >::iterator it = read_ts.begin();
+       it != read_ts.end(); ++it)
+  {
+    commit_ts = std::max(commit_ts, it->second.first);
+  }
+  for (vector<Record *>::iterator it = locked.begin(); it != locked.end(); ++it)
+  {
+    commit_ts = std::max(commit_ts, (*it)->rts_ + 1);
+  }
+
+  // validation: every version we read must still be valid at commit_ts
+  bool valid = true;
+  for (map<Key, std::pair<uint64, uint64> >::iterator it = read_ts.begin();
+       it != read_ts.end() && valid; ++it)
+  {
+    Record *record = storage_->GetRecord(it->first);
+    if (commit && txn->writeset_.count(it->first) > 0)
+    {
+      // we hold the lock, so only a commit before it could have changed it
+      valid = (record->wts_ & ~TID_LOCK_BIT) == it->second.first;
+      continue;
+    }
+    if (it->second.second >= commit_ts)
+    {
+      continue;
+    }
+    // extend the rts of the version we read, unless it has been overwritten
+    // or is about to be; the record is locked while we do so, so no writer
+    // can pick a wts at or below the new rts
+    uint64 wts = it->second.first;
+    if (!__sync_bool_compare_and_swap(&record->wts_, wts, wts | TID_LOCK_BIT))
+    {
+      valid = false;
+      break;
+    }
+    if (record->rts_ < commit_ts)
+      record->rts_ = commit_ts;
+    __sync_synchronize();
+    record->wts_ = wts;
+  }
+
+  if (valid && !commit)
+  {
+    txn->status_ = ABORTED;
+    txn_results_.Push(txn);
+    return;
+  }
+  if (valid)
+  {
+    // write phase: install the writes under the new wts, then release the
+    // writeset
+    for (map<Key, Value>::iterator it = txn->writes_.begin();
+         it != txn->writes_.end(); ++it)
+    {
+      Record *record = storage_->GetRecord(it->first);
+      record->value_ = it->second;
+      record->version_++;
+      record->rts_ = commit_ts;
+      record->wts_ = commit_ts | TID_LOCK_BIT;
+    }
+    __sync_synchronize();
+    for (vector<Record *>::iterator it = locked.begin(); it != locked.end(); ++it)
+    {
+      (*it)->wts_ &= ~TID_LOCK_BIT;
+    }
+    txn->status_ = COMMITTED;
+    txn_results_.Push(txn);
+    return;
+  }
+
+  // release the writeset unchanged, and run the txn again after a backoff
+  for (vector<Record *>::iterator it = locked.begin(); it != locked.end(); ++it)
+  {
+    (*it)->wts_ &= ~TID_LOCK_BIT;
+  }
+  RestartTxn(txn);
+}
+
+void TxnProcessor::MVCCExecuteTxn(Txn* txn) {
+  if (mode_ == MVCC && txn->writeset_.empty()) {
+    MVCCExecuteReadOnlyTxn(txn);
+    return;
+  }
+
+  if (!MVCCTryTxn(txn, false)) {
+    // completely restart the transaction
+    RestartTxn(txn);
+  }
+}
+
+bool TxnProcessor::MVCCTryTxn(Txn* txn, bool escalated) {
+  if (mode_ == SSI) {
+    SSIBegin(txn);
+  }
+
+  // Read all necessary data for this transaction from storage. Reads take
+  // no latch, but SSI txns hold the key while they leave their SIREAD marker.
+  // read for readset
+  for (auto read_key : txn->readset_) {
+    Value result;
+    if (storage_->Read(read_key, &result, txn->unique_id_)) {
+      txn->reads_[read_key] = result;
+    }
+    if (mode_ == SSI) {
+      storage_->Lock(read_key);
+      SSIRead(txn, read_key);
+      storage_->Unlock(read_key);
+    }
   }
 
   // read for writeset
   for (auto write_key : txn->writeset_) {
     Value result;
-    storage_->Lock(write_key);
-    if (storage_->Read(write_key, &result)) {
+    if (storage_->Read(write_key, &result, txn->unique_id_)) {
       txn->reads_[write_key] = result;
     }
-    storage_->Unlock(write_key);
+    if (mode_ == SSI) {
+      storage_->Lock(write_key);
+      SSIRead(txn, write_key);
+      storage_->Unlock(write_key);
+    }
   }
 
   // Execute the transaction logic (i.e. call Run() on the transaction)
   txn->Run();
 
+  if (txn->Status() == COMPLETED_A) {
+    // the txn read a snapshot no write can change any more, so it can abort
+    // right away, without conflicting with anyone
+    if (mode_ == SSI) {
+      ssi_mutex_.Lock();
+      delete ssi_txns_[txn->unique_id_];
+      ssi_txns_.erase(txn->unique_id_);
+      ssi_mutex_.Unlock();
+    }
+    txn->status_ = ABORTED;
+    FinishMVCCTxn(txn);
+    txn_results_.Push(txn);
+    return true;
+  }
+
   // Acquire all locks for keys in the write_set_
-  // Call MVCCStorage::CheckWrite method to check all keys in the write_set_
+  // Call MVCCStorage::CheckWrite method to check all keys in the write_set_,
+  // and give up keys an escalated txn has reserved
+  bool retimestamp = escalated && mode_ == MVCC;
   bool passed = true;
+  vector<Key> locked;
   for (auto write_key : txn->writeset_) {
     storage_->Lock(write_key);
-    if (!storage_->CheckWrite(write_key, txn->unique_id_)) {
+    locked.push_back(write_key);
+    bool valid = escalated || !storage_->Reserved(write_key);
+    if (valid && !retimestamp) {
+      valid = mode_ == MVCC ? storage_->CheckWrite(write_key, txn->unique_id_)
+                            : storage_->CheckSnapshotWrite(write_key, txn->unique_id_);
+    }
+    if (!valid) {
       passed = false;
       break;
     }
   }
 
+  if (passed && retimestamp) {
+    // no other txn has written the keys of an escalated txn since it
+    // reserved them, so what it read is still the latest, and it can commit
+    // after every txn so far. Txns that come later cannot read the writeset
+    // until we have written all of it, so no later read makes us fail.
+    mutex_.Lock();
+    AssignUniqueId(txn);
+    mutex_.Unlock();
+    for (auto read_key : txn->readset_) {
+      Value result;
+      storage_->Read(read_key, &result, txn->unique_id_);
+    }
+    for (auto write_key : txn->writeset_) {
+      passed = passed && storage_->CheckWrite(write_key, txn->unique_id_);
+    }
+  }
+
+  if (passed && mode_ == SI) {
+    // commit after every snapshot taken so far. Txns that take theirs later
+    // cannot read the writeset until we have written all of it.
+    mutex_.Lock();
+    AssignUniqueId(txn);
+    mutex_.Unlock();
+  } else if (passed && mode_ == SSI) {
+    passed = SSIValidate(txn);
+  } else if (mode_ == SSI) {
+    ssi_mutex_.Lock();
+    delete ssi_txns_[txn->unique_id_];
+    ssi_txns_.erase(txn->unique_id_);
+    ssi_mutex_.Unlock();
+  }
+
   // check if writes valid
   if (passed) {
-    // passed, Apply the writes
+    // passed, Apply the writes, and free the versions they make unreachable
     txn->status_ = COMPLETED_C;
     ApplyWrites(txn);
     txn->status_ = COMMITTED;    
-    txn_results_.Push(txn);
-  } else {
-    // cleanup txn
-    txn->reads_.clear();
-    txn->writes_.clear();
-    txn->status_ = INCOMPLETE;
+    for (auto write : txn->writes_) {
+      storage_->GarbageCollect(write.first, mvcc_low_watermark_);
+    }
+  }
 
-    // completely restart the transaction
-    mutex_.Lock();
-    txn->unique_id_ = next_unique_id_;
-    next_unique_id_++;
-    txn_requests_.Push(txn);
-    mutex_.Unlock(); 
+  // Release all locks for keys in the write_set_ we got to
+  for (auto key : locked) {
+    storage_->Unlock(key);
   }
 
-  // Release all locks for keys in the write_set_
-  for (auto keys : txn->writeset_) {
-    storage_->Unlock(keys);
+  if (passed) {
+    FinishMVCCTxn(txn);
+    txn_results_.Push(txn);
   }
+  return passed;
+}
+
+void TxnProcessor::MVCCExecuteReadOnlyTxn(Txn* txn) {
+  // every version at or below the snapshot is written, and none will be added
+  mutex_.Lock();
+  ForgetUniqueId(txn);
+  txn->unique_id_ = mvcc_writer_ids_.empty() ? next_unique_id_ - 1
+                                             : *mvcc_writer_ids_.begin() - 1;
+  mvcc_active_ids_.insert(txn->unique_id_);
+  mutex_.Unlock();
+
+  for (auto read_key : txn->readset_) {
+    Value result;
+    if (storage_->SnapshotRead(read_key, &result, txn->unique_id_)) {
+      txn->reads_[read_key] = result;
+    }
+  }
+
+  txn->Run();
+  txn->status_ = txn->Status() == COMPLETED_C ? COMMITTED : ABORTED;
+
+  FinishMVCCTxn(txn);
+  txn_results_.Push(txn);
 }
 
 void TxnProcessor::RunMVCCScheduler() {
@@ -490,12 +1506,158 @@ void TxnProcessor::RunMVCCScheduler() {
 
   // check for active transaction requests in pool
   // Pop a txn from txn_requests_, and pass it to a thread to execute. 
-  while (tp_.Active()) {
+  while (!stopped_) {
     // get next new transaction request 
     if (txn_requests_.Pop(&txn)) {
       // transaction is pending, pass to exec thread
       tp_.RunTask(new Method<TxnProcessor, void, Txn *>(this, &TxnProcessor::MVCCExecuteTxn, txn));
     }
+    ScheduleRestarts();
   }
 }
 
+void TxnProcessor::AssignUniqueId(Txn *txn) {
+  if (multiversion_) {
+    // a restarted txn gives up its old id. New txns have none yet, and 0 may
+    // be the id of a read-only txn.
+    if (txn->unique_id_ != 0) {
+      ForgetUniqueId(txn);
+    }
+    mvcc_active_ids_.insert(next_unique_id_);
+    if (mode_ == MVCC && !txn->writeset_.empty()) {
+      mvcc_writer_ids_.insert(next_unique_id_);
+    }
+  }
+  txn->unique_id_ = next_unique_id_;
+  next_unique_id_++;
+}
+
+void TxnProcessor::ForgetUniqueId(Txn *txn) {
+  auto active_id = mvcc_active_ids_.find(txn->unique_id_);
+  if (active_id != mvcc_active_ids_.end()) {
+    mvcc_active_ids_.erase(active_id);
+  }
+  if (!txn->writeset_.empty()) {
+    mvcc_writer_ids_.erase(txn->unique_id_);
+  }
+}
+
+void TxnProcessor::FinishMVCCTxn(Txn *txn) {
+  mutex_.Lock();
+  ForgetUniqueId(txn);
+  mutex_.Unlock();
+}
+
+uint64 TxnProcessor::LowWatermark() {
+  // read-only txns that start later may read just below the first writer
+  mutex_.Lock();
+  uint64 low_watermark = mvcc_writer_ids_.empty() ? next_unique_id_ - 1
+                                                  : *mvcc_writer_ids_.begin() - 1;
+  if (!mvcc_active_ids_.empty()) {
+    low_watermark = std::min(low_watermark, *mvcc_active_ids_.begin());
+  }
+  mutex_.Unlock();
+
+  if (mode_ == SSI) {
+    // a committed txn can only conflict with txns whose snapshot comes before
+    // its commit
+    ssi_mutex_.Lock();
+    while (!ssi_commits_.empty() && ssi_commits_.begin()->first < low_watermark) {
+      SSITxn *retired = ssi_commits_.begin()->second;
+      ssi_commits_.erase(ssi_commits_.begin());
+      ssi_txns_.erase(retired->snapshot_id_);
+      delete retired;
+    }
+    if (!ssi_txns_.empty() && ssi_txns_.begin()->first < low_watermark) {
+      low_watermark = ssi_txns_.begin()->first;
+    }
+    ssi_mutex_.Unlock();
+  }
+  return low_watermark;
+}
+
+void TxnProcessor::GarbageCollection() {
+  while (!stopped_) {
+    mvcc_low_watermark_ = LowWatermark();
+    storage_->Sweep(mvcc_low_watermark_, MVCC_GC_SWEEP_KEYS);
+    usleep(MVCC_GC_INTERVAL);
+  }
+}
+
+void TxnProcessor::SSIBegin(Txn *txn) {
+  SSITxn *ssi_txn = new SSITxn();
+  ssi_txn->snapshot_id_ = txn->unique_id_;
+  ssi_txn->commit_id_ = 0;
+  ssi_txn->in_conflict_ = false;
+  ssi_txn->out_conflict_ = false;
+  ssi_txn->doomed_ = false;
+
+  ssi_mutex_.Lock();
+  ssi_txns_[txn->unique_id_] = ssi_txn;
+  ssi_mutex_.Unlock();
+}
+
+void TxnProcessor::SSIRead(Txn *txn, Key key) {
+  vector<int> later_versions;
+  storage_->MarkRead(key, txn->unique_id_, &later_versions);
+  if (later_versions.empty()) {
+    return;
+  }
+
+  // the writers of the later versions committed after our snapshot was taken
+  ssi_mutex_.Lock();
+  SSITxn *reader = ssi_txns_[txn->unique_id_];
+  for (auto version_id : later_versions) {
+    auto writer = ssi_commits_.find(version_id);
+    if (writer == ssi_commits_.end()) {
+      continue;
+    }
+    reader->out_conflict_ = true;
+    writer->second->in_conflict_ = true;
+    if (writer->second->out_conflict_) {
+      // the writer is a committed pivot
+      reader->doomed_ = true;
+    }
+  }
+  ssi_mutex_.Unlock();
+}
+
+bool TxnProcessor::SSIValidate(Txn *txn) {
+  ssi_mutex_.Lock();
+  SSITxn *writer = ssi_txns_[txn->unique_id_];
+  for (auto key : txn->writeset_) {
+    vector<int> readers;
+    storage_->GetReaders(key, &readers);
+    for (auto reader_id : readers) {
+      auto reader = ssi_txns_.find(reader_id);
+      // skip ourselves, restarted readers, and readers that committed before
+      // our snapshot was taken
+      if (reader == ssi_txns_.end() || reader->second == writer ||
+          (reader->second->commit_id_ != 0 &&
+           reader->second->commit_id_ < writer->snapshot_id_)) {
+        continue;
+      }
+      reader->second->out_conflict_ = true;
+      writer->in_conflict_ = true;
+      if (reader->second->commit_id_ != 0 && reader->second->in_conflict_) {
+        // the reader is a committed pivot
+        writer->doomed_ = true;
+      }
+    }
+  }
+
+  if (writer->doomed_ || (writer->in_conflict_ && writer->out_conflict_)) {
+    ssi_txns_.erase(txn->unique_id_);
+    ssi_mutex_.Unlock();
+    delete writer;
+    return false;
+  }
+
+  mutex_.Lock();
+  AssignUniqueId(txn);
+  mutex_.Unlock();
+  writer->commit_id_ = txn->unique_id_;
+  ssi_commits_[writer->commit_id_] = writer;
+  ssi_mutex_.Unlock();
+  return true;
+}
@@ -2,9 +2,14 @@
 #ifndef _TXN_PROCESSOR_H_
 #define _TXN_PROCESSOR_H_
 
+#include <tr1/unordered_map>
 #include <deque>
+#include <functional>
 #include <map>
+#include <queue>
 #include <string>
+#include <utility>
+#include <vector>
 
 #include "txn/common.h"
 #include "txn/lock_manager.h"
@@ -18,27 +23,58 @@
 
 using std::deque;
 using std::map;
+using std::pair;
+using std::priority_queue;
 using std::string;
+using std::vector;
+using std::tr1::unordered_map;
 
-// The TxnProcessor supports five different execution modes, corresponding to
-// the four parts of assignment 2, plus a simple serial (non-concurrent) mode.
+// The TxnProcessor supports eleven different execution modes, corresponding to
+// the four parts of assignment 2 and their variants, plus a simple serial
+// (non-concurrent) mode.
 enum CCMode
 {
   SERIAL = 0,  // Serial transaction execution (no concurrency)
   LOCKING = 1, // Part 1 - 2PL Shared & Exclusive
   OCC = 2,     // Part 2
   MVCC = 3,
+  CALVIN = 4,  // Deterministic locking in sequencer order
+  VLL = 5,     // Very lightweight locking in sequencer order
+  P_OCC = 6,   // OCC with validation done by the workers in parallel
+  SILO = 7,    // Decentralized OCC with per-record TIDs and epochs
+  TICTOC = 8,  // OCC with commit timestamps computed from the records used
+  SI = 9,      // Snapshot isolation on MVCC storage, first committer wins
+  SSI = 10,    // Serializable snapshot isolation
 };
 
 // Returns a human-readable string naming of the providing mode.
 string ModeToString(CCMode mode);
 
+// rw-antidependencies of an SSI txn, kept until every txn that ran
+// concurrently with it is done.
+struct SSITxn
+{
+  uint64 snapshot_id_;  // unique_id_ the txn reads at
+  uint64 commit_id_;    // unique_id_ the txn commits at, or 0 while it runs
+  bool in_conflict_;    // a concurrent txn did not see a write of this one
+  bool out_conflict_;   // this txn did not see a write of a concurrent one
+  bool doomed_;         // the txn must abort
+};
+
 class TxnProcessor
 {
 public:
   // The TxnProcessor's constructor starts the TxnProcessor running in the
-  // background.
-  explicit TxnProcessor(CCMode mode);
+  // background. 'policy' selects how the LOCKING mode handles deadlocks. With
+  // ORDERED, txns acquire their locks in a global order, so they cannot
+  // deadlock in the first place.
+  //
+  // In LOCKING and CALVIN mode, a txn that needs more than
+  // 'lock_escalation_threshold' record locks locks whole granules instead.
+  // 0 disables hierarchical locking, so txns only lock records and never pay
+  // for intention locks.
+  explicit TxnProcessor(CCMode mode, DeadlockPolicy policy = ORDERED,
+                        int lock_escalation_threshold = 0);
 
   // The TxnProcessor's destructor stops all background threads and deallocates
   // all objects currently owned by the TxnProcessor, except for Txn objects.
@@ -52,18 +88,36 @@ public:
   // ownership of the returned Txn.
   Txn *GetTxnResult();
 
+  // Returns the number of times a txn has been rolled back by the lock
+  // manager to prevent deadlock (LOCKING mode only).
+  int DeadlockAborts();
+
+  // Returns the number of times a txn has failed validation and been
+  // restarted, and how many of those restarts ran the txn escalated (OCC,
+  // P_OCC, SILO, TICTOC, MVCC, SI and SSI modes only).
+  int Restarts();
+  int EscalatedRestarts();
+
   // Main loop implementing all concurrency control/thread scheduling.
   void RunScheduler();
 
   static void *StartScheduler(void *arg);
 
+  static void *StartGarbageCollector(void *arg);
+
 private:
   // Serial validation
   bool SerialValidate(Txn *txn);
 
-  // Parallel executtion/validation for OCC
+  // Parallel execution/validation for OCC. Runs 'txn', validates it against
+  // the txns that committed since it started and the ones validating at the
+  // same time, and then commits, repairs or restarts it, all on the calling
+  // worker.
   void ExecuteTxnParallel(Txn *txn);
 
+  // Removes 'txn' from 'active_set_' once it is done validating.
+  void LeaveActiveSet(Txn *txn);
+
   // Serial version of scheduler.
   void RunSerialScheduler();
 
@@ -73,40 +127,197 @@ private:
   // OCC version of scheduler.
   void RunOCCScheduler();
 
-  // // OCC version of scheduler with parallel validation.
-  // void RunOCCParallelScheduler();
+  // OCC version of scheduler with parallel validation.
+  void RunOCCParallelScheduler();
 
   // MVCC version of scheduler.
   void RunMVCCScheduler();
 
+  // Scheduler of the SILO and TICTOC modes. Txns go straight from
+  // NewTxnRequest() to the workers, so the scheduler thread only runs the
+  // restarted txns whose backoff is over, and in SILO mode advances 'epoch_'
+  // every SILO_EPOCH_INTERVAL.
+  void RunWorkerScheduler();
+
+  // Runs 'txn' Silo-style on the calling worker: it reads records along with
+  // their TIDs, locks its writeset in key order, checks that the TIDs of
+  // everything it read are unchanged, and then installs its writes under a
+  // new TID from the current epoch. A txn that fails the check is restarted
+  // with RestartTxn().
+  void SiloExecuteTxn(Txn *txn);
+
+  // Runs 'txn' TicToc-style on the calling worker. Like SiloExecuteTxn(), but
+  // instead of requiring that nothing it read has changed, it picks a commit
+  // timestamp from the wts/rts of the records it used, at which all of its
+  // reads are still valid, extending their 'rts_' where needed.
+  void TicTocExecuteTxn(Txn *txn);
+
+  // Deterministic locking version of scheduler, also used for VLL. The
+  // scheduler thread acts as the sequencer: it requests all locks of each
+  // batch of txns in unique_id_ order, so txns never deadlock and are never
+  // rolled back.
+  void RunCalvinScheduler();
+
   // Performs all reads required to execute the transaction, then executes the
   // transaction logic.
 
   void ReleaseLocks(Txn *txn);
   void ExecuteTxn(Txn *txn);
+
+  // Reads every record in the txn's readset and writeset into its 'reads_'.
+  void ReadTxn(Txn *txn);
+
+  // Same as ReadTxn(), but first notes the version of every record in the
+  // txn's 'occ_versions_' for validation.
+  void OCCReadTxn(Txn *txn);
+
+  // Makes 'txn', which is about to read, depend on the writers of its records
+  // that released their locks early but have not been reported yet.
+  void AddCommitDependencies(Txn *txn);
+
+  // Reports 'txn' to the client once it is done and everything it depends on
+  // has been reported, along with any dependents that were only waiting for it.
+  void ReportTxn(Txn *txn);
+
+  // Requests all locks needed by 'txn', and runs it if they are all granted
+  // right away.
   void ProcessTxn(Txn *txn);
+
+  // Requests all locks needed by 'txn'. Returns true if the txn may run now.
+  // Otherwise the txn is parked in the lock manager, which hands it to
+  // 'ready_txns_' once its last lock is granted (or it is aborted). With
+  // 'ordered_locking_', it is only handed over once the request it parked on
+  // is granted, and must call AcquireLocks() again to make the rest.
+  bool AcquireLocks(Txn *txn);
+
+  // Runs a txn once the lock manager has granted all of its locks (or has
+  // aborted it, in which case the txn is restarted).
+  void ExecuteLockedTxn(Txn *txn);
+  // Prepares an OCC txn that failed validation to run again without starting
+  // over: rereads the records that changed since it read them, along with
+  // the ones it wrote to, and drops its writes.
+  void RefreshStaleReads(Txn *txn);
+
+  // Runs an OCC txn again after RefreshStaleReads() and hands it back to the
+  // scheduler thread for validation.
+  void RepairTxn(Txn *txn);
+
+  // Rolls back 'txn' after it failed validation, and queues it on
+  // 'restarted_txns_' to be run again after an exponential backoff.
+  void RestartTxn(Txn *txn);
+
+  // Called by the schedulers of the modes that restart txns. Runs the
+  // restarted txns whose backoff is over: as a new txn request, or escalated
+  // on a worker if they have already lost too often.
+  void ScheduleRestarts();
+
+  // Gives 'txn' a new unique_id_ and hands it to the scheduler thread, or
+  // straight to a worker in SILO and TICTOC mode. Requires 'mutex_' to be
+  // held.
+  void SubmitTxn(Txn *txn);
+
+  // Runs a txn that has been restarted too often in a way that cannot fail
+  // validation: while the scheduler pauses validation for OCC, after draining
+  // 'active_set_' for P_OCC, and holding all of its records for SILO and
+  // TICTOC. In the multiversion modes, it reserves its records, which holds
+  // off other writers but not readers, and runs again until it passes.
+  void ExecuteEscalatedTxn(Txn *txn);
+
+  // Releases the records 'keys' that an escalated SILO or TICTOC txn held,
+  // publishing its writes under a new TID or timestamp if it committed.
+  void UnlockEscalatedRecords(Txn *txn, const set<Key> &keys);
+
   // Applies all writes performed by '*txn' to 'storage_'.
   //
   // Requires: txn->Status() is COMPLETED_C.
   void ApplyWrites(Txn *txn);
 
-  // The following functions are for MVCC
+  // The following functions are for MVCC. In SI and SSI modes,
+  // MVCCExecuteTxn() only checks the writeset for keys written since the
+  // txn's snapshot, and then takes a new unique_id_ to commit at.
   void MVCCExecuteTxn(Txn *txn);
 
+  // Runs 'txn' once at its current unique_id_, holding its writeset only
+  // while it checks and installs its writes. Returns false if the txn failed
+  // validation and has to run again; otherwise it has been reported. Txns
+  // fail on keys an escalated txn has reserved, unless 'escalated' is set:
+  // then 'txn' is that txn, and in MVCC mode it commits at a new unique_id_.
+  bool MVCCTryTxn(Txn *txn, bool escalated);
+
+  // Runs a txn with an empty writeset in MVCC mode. It reads at a unique_id_
+  // below every writer that has not finished, so it cannot conflict with
+  // any of them and leaves no read timestamps behind.
+  void MVCCExecuteReadOnlyTxn(Txn *txn);
+
+  // Starts tracking the rw-antidependencies of 'txn' at its current
+  // unique_id_ (used for SSI).
+  void SSIBegin(Txn *txn);
+
+  // Leaves an SIREAD marker of 'txn' on 'key', and records an
+  // rw-antidependency on every txn that wrote a later version of it. Requires
+  // 'key' to be locked.
+  void SSIRead(Txn *txn, Key key);
+
+  // Records an rw-antidependency from every concurrent reader of the
+  // writeset of 'txn' to it. Returns false, and forgets 'txn', if that leaves
+  // a txn with both an inbound and an outbound rw-antidependency, at least
+  // one of them to a committed txn. Otherwise gives 'txn' a new unique_id_ to
+  // commit at and returns true. Requires the writeset to be locked.
+  bool SSIValidate(Txn *txn);
+
   // bool MVCCCheckWrites(Txn *txn);
 
   // void MVCCLockWriteKeys(Txn *txn);
 
   // void MVCCUnlockWriteKeys(Txn *txn);
 
-  // void GarbageCollection();
+  // Background sweeper of MVCC mode: every MVCC_GC_INTERVAL, refreshes
+  // 'mvcc_low_watermark_' and garbage collects the next MVCC_GC_SWEEP_KEYS
+  // keys. Keys that are written are also collected by the writer.
+  void GarbageCollection();
+
+  // Returns the smallest unique_id_ any MVCC txn currently holds or may be
+  // given later. No txn can read a version that is older than the newest one
+  // at or below it. In SSI mode, also forgets the committed txns that no
+  // running txn is concurrent with, and stays below the snapshot of the rest.
+  uint64 LowWatermark();
+
+  // Gives 'txn' the next unique_id_. Requires 'mutex_' to be held.
+  void AssignUniqueId(Txn *txn);
+
+  // Removes one occurrence of the unique_id_ of 'txn' from the MVCC id sets.
+  // Requires 'mutex_' to be held.
+  void ForgetUniqueId(Txn *txn);
+
+  // Forgets the unique_id_ of an MVCC txn that is done.
+  void FinishMVCCTxn(Txn *txn);
 
   // Concurrency control mechanism the TxnProcessor is currently using.
   CCMode mode_;
 
+  // True if txns acquire their locks through LockManager::AcquireAll().
+  bool ordered_locking_;
+
+  // Number of record locks above which a txn locks granules instead, or 0 if
+  // txns only lock records.
+  int lock_escalation_threshold_;
+
+  // True if txns run on MVCCStorage (MVCC, SI and SSI modes).
+  bool multiversion_;
+
   // Thread pool managing all threads used by TxnProcessor.
   StaticThreadPool tp_;
 
+  // Thread running 'RunScheduler()', and the flag telling it to exit.
+  pthread_t scheduler_thread_;
+  volatile bool stopped_;
+
+  // Thread running 'GarbageCollection()' in MVCC, SI and SSI modes.
+  pthread_t gc_thread_;
+
+  // Current Silo epoch, advanced periodically by the scheduler thread.
+  volatile uint64 epoch_;
+
   // Data storage used for all modes.
   Storage *storage_;
 
@@ -114,14 +325,29 @@ private:
   int next_unique_id_;
   Mutex mutex_;
 
+  // unique_id_s of the MVCC txns that are queued or running, guarded by
+  // 'mutex_', and the last LowWatermark() computed from them. Read-only txns
+  // may share theirs. 'mvcc_writer_ids_' holds the ones of MVCC mode txns
+  // that have a writeset.
+  std::multiset<uint64> mvcc_active_ids_;
+  set<uint64> mvcc_writer_ids_;
+  volatile uint64 mvcc_low_watermark_;
+
+  // SSI txns that are running or may still conflict with a running txn, by
+  // snapshot id, and the committed ones among them by commit id. Guarded by
+  // 'ssi_mutex_', which is taken after any storage locks and before 'mutex_'.
+  map<uint64, SSITxn *> ssi_txns_;
+  map<uint64, SSITxn *> ssi_commits_;
+  Mutex ssi_mutex_;
+
   // Queue of incoming transaction requests.
   AtomicQueue<Txn *> txn_requests_;
 
   // Queue of txns that have acquired all locks and are ready to be executed.
   //
-  // Does not need to be atomic because RunScheduler is the only thread that
-  // will ever access this queue.
-  deque<Txn *> ready_txns_;
+  // Filled by the lock manager from whichever worker releases the last lock a
+  // parked txn was waiting for, and drained by RunScheduler.
+  AtomicQueue<Txn *> ready_txns_;
 
   // Queue of completed (but not yet committed/aborted) transactions.
   AtomicQueue<Txn *> completed_txns_;
@@ -137,8 +363,37 @@ private:
   // Used it for critical section in parallel occ.
   Mutex active_set_mutex_;
 
-  // Lock Manager used for LOCKING concurrency implementations.
+  // True while an escalated txn keeps other txns from joining 'active_set_'.
+  // Guarded by 'active_set_mutex_'.
+  bool active_set_closed_;
+
+  // Broadcast under 'active_set_mutex_' whenever 'active_set_closed_' is
+  // cleared or a txn leaves 'active_set_' while it is set.
+  Condition active_set_changed_;
+
+  // True while an escalated OCC txn runs on a worker. The scheduler thread
+  // validates and commits no other txn in the meantime.
+  volatile bool validation_paused_;
+
+  // Txns rolled back by RestartTxn(), and the ones among them that are waiting
+  // out their backoff, earliest 'restart_time_' first. Only the scheduler
+  // thread uses 'restart_queue_'.
+  AtomicQueue<Txn *> restarted_txns_;
+  priority_queue<pair<double, Txn *>, vector<pair<double, Txn *> >,
+                 std::greater<pair<double, Txn *> > > restart_queue_;
+
+  // Counts returned by Restarts() and EscalatedRestarts().
+  int restarts_;
+  int escalated_restarts_;
+
+  // Lock Manager used for LOCKING, CALVIN and VLL concurrency implementations.
   LockManager *lm_;
+
+  // Txns that released their locks early but have not been reported yet, by
+  // unique_id_, mapped to the txns that depend on them, and a mutex guarding
+  // it along with the 'commit_dependencies_' of all txns.
+  unordered_map<uint64, vector<Txn *> > unreported_txns_;
+  Mutex unreported_mutex_;
 };
 
 #endif // _TXN_PROCESSOR_H_
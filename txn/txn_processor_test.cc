@@ -4,6 +4,11 @@
 #include "utils/testing.h"
 #include <sched.h>
 
+// Options of txn_processor.cc.
+extern bool TXN_REPAIR;
+extern bool EARLY_LOCK_RELEASE;
+extern bool OCC_EARLY_ABORT;
+
 // Returns a human-readable string naming of the providing mode.
 string ModeToString(CCMode mode)
 {
@@ -17,11 +22,164 @@ string ModeToString(CCMode mode)
     return " OCC      ";
   case MVCC:
     return " MVCC     ";
+  case CALVIN:
+    return " Calvin   ";
+  case VLL:
+    return " VLL      ";
+  case P_OCC:
+    return " OCC-P    ";
+  case SILO:
+    return " Silo     ";
+  case TICTOC:
+    return " TicToc   ";
+  case SI:
+    return " SI       ";
+  case SSI:
+    return " SSI      ";
   default:
     return "INVALID MODE";
   }
 }
 
+// Reads every key of its readset, and commits iff they all hold the same
+// value.
+class ReadEqual : public Txn
+{
+public:
+  explicit ReadEqual(const set<Key> &readset) { readset_ = readset; }
+
+  ReadEqual *clone() const
+  {
+    ReadEqual *clone = new ReadEqual(readset_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  virtual void Run()
+  {
+    Value first = 0;
+    Value result = 0;
+    for (set<Key>::iterator it = readset_.begin(); it != readset_.end(); ++it)
+    {
+      Read(*it, &result);
+      if (it == readset_.begin())
+        first = result;
+      else if (result != first)
+        ABORT;
+    }
+    COMMIT;
+  }
+};
+
+// Reads its own key and another one, and sets its own key to 0 if neither
+// of them is 0 yet, so that run one after the other, two of them on the same
+// keys leave one of the keys alone.
+class OnCall : public Txn
+{
+public:
+  OnCall(Key own, Key other, double time) : time_(time)
+  {
+    readset_.insert(other);
+    writeset_.insert(own);
+  }
+
+  OnCall *clone() const
+  {
+    OnCall *clone = new OnCall(0, 0, time_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  virtual void Run()
+  {
+    Key own = *writeset_.begin();
+    Value mine = 0;
+    Value theirs = 0;
+    Read(own, &mine);
+    Read(*readset_.begin(), &theirs);
+
+    // take long enough for the other txn to read before we commit
+    double begin = GetTime();
+    while (GetTime() - begin < time_)
+    {
+    }
+    if (mine != 0 && theirs != 0)
+      Write(own, 0);
+    COMMIT;
+  }
+
+private:
+  double time_;
+};
+
+// Increments a key, and remembers the value it read.
+class Increment : public Txn
+{
+public:
+  explicit Increment(Key key) : read_(0) { writeset_.insert(key); }
+
+  Increment *clone() const
+  {
+    Increment *clone = new Increment(*writeset_.begin());
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  virtual void Run()
+  {
+    Key key = *writeset_.begin();
+    Read(key, &read_);
+    Write(key, read_ + 1);
+    COMMIT;
+  }
+
+  Value read_;
+};
+
+// Reads one key and increments another, spending 'time' seconds in between,
+// and counts how often Revalidate() made it give up early.
+class SlowIncrement : public Txn
+{
+public:
+  SlowIncrement(Key read, Key own, double time) : early_aborts_(0), time_(time)
+  {
+    readset_.insert(read);
+    writeset_.insert(own);
+  }
+
+  SlowIncrement *clone() const
+  {
+    SlowIncrement *clone = new SlowIncrement(0, 0, time_);
+    this->CopyTxnInternals(clone);
+    return clone;
+  }
+
+  virtual void Run()
+  {
+    Key own = *writeset_.begin();
+    Value result = 0;
+    Read(*readset_.begin(), &result);
+    Read(own, &result);
+    Write(own, result + 1);
+
+    double begin = GetTime();
+    while (GetTime() - begin < time_)
+    {
+      if (!Revalidate())
+      {
+        early_aborts_++;
+        ABORT;
+      }
+    }
+    COMMIT;
+  }
+
+  int early_aborts_;
+
+private:
+  double time_;
+};
+
 class LoadGen
 {
 public:
@@ -81,6 +239,414 @@ private:
   double wait_time_;
 };
 
+// Submits all of 'txns' to 'p' at once, and waits for them to finish.
+// Returns the number of them that committed.
+int RunTxns(TxnProcessor *p, const vector<Txn *> &txns)
+{
+  for (uint32 i = 0; i < txns.size(); i++)
+    p->NewTxnRequest(txns[i]);
+
+  int committed = 0;
+  for (uint32 i = 0; i < txns.size(); i++)
+  {
+    Txn *txn = p->GetTxnResult();
+    if (txn->Status() == COMMITTED)
+      committed++;
+    delete txn;
+  }
+  return committed;
+}
+
+// Returns true if a txn run on 'p' reads every key of 'values' at its value.
+bool Holds(TxnProcessor *p, const map<Key, Value> &values)
+{
+  p->NewTxnRequest(new Expect(values));
+  Txn *txn = p->GetTxnResult();
+  bool holds = txn->Status() == COMMITTED;
+  delete txn;
+  return holds;
+}
+
+// Sets 'pairs' pairs of keys to 1 on 'p', then runs a pair of OnCall txns on
+// each of them at once. Returns how many pairs both txns set to 0, which a
+// serializable schedule never does.
+int WriteSkews(TxnProcessor *p, int pairs)
+{
+  map<Key, Value> ones;
+  for (int i = 0; i < 2 * pairs; i++)
+    ones[10 + i] = 1;
+  vector<Txn *> txns;
+  txns.push_back(new Put(ones));
+  EXPECT_EQ(1, RunTxns(p, txns));
+
+  txns.clear();
+  for (int i = 0; i < pairs; i++)
+  {
+    txns.push_back(new OnCall(10 + 2 * i, 11 + 2 * i, 0.001));
+    txns.push_back(new OnCall(11 + 2 * i, 10 + 2 * i, 0.001));
+  }
+  EXPECT_EQ(2 * pairs, RunTxns(p, txns));
+
+  int skews = 0;
+  for (int i = 0; i < pairs; i++)
+  {
+    map<Key, Value> zeros;
+    zeros[10 + 2 * i] = 0;
+    zeros[11 + 2 * i] = 0;
+    if (Holds(p, zeros))
+      skews++;
+  }
+  return skews;
+}
+
+// Runs 'count' txns of the given duration on a fresh 'p' that each increment
+// two of the keys 0 to 3 and read a third one, all at once, and checks that
+// they all commit without losing an increment.
+void CheckIncrements(TxnProcessor *p, int count, double time)
+{
+  vector<Txn *> txns;
+  for (int i = 0; i < count; i++)
+  {
+    set<Key> readset, writeset;
+    writeset.insert(i % 4);
+    writeset.insert((i + 1) % 4);
+    readset.insert((i + 2) % 4);
+    txns.push_back(new RMW(readset, writeset, time));
+  }
+  EXPECT_EQ(count, RunTxns(p, txns));
+
+  map<Key, Value> values;
+  for (Key key = 0; key < 4; key++)
+    values[key] = count / 2;
+  EXPECT_TRUE(Holds(p, values));
+}
+
+// Runs 'count' txns on a fresh 'p', half of which increment the keys 4 to 7
+// together, while the other half read them and abort if they do not all hold
+// the same value. Checks that every reader sees a consistent state (or is
+// retried until it does) and that no increment is lost.
+void CheckConsistentReads(TxnProcessor *p, int count, double time)
+{
+  set<Key> keys;
+  for (Key key = 4; key < 8; key++)
+    keys.insert(key);
+
+  vector<Txn *> txns;
+  for (int i = 0; i < count; i++)
+  {
+    if (i % 2 == 0)
+      txns.push_back(new RMW(keys, time));
+    else
+      txns.push_back(new ReadEqual(keys));
+  }
+  EXPECT_EQ(count, RunTxns(p, txns));
+
+  map<Key, Value> values;
+  for (Key key = 4; key < 8; key++)
+    values[key] = count / 2;
+  EXPECT_TRUE(Holds(p, values));
+}
+
+TEST(ParallelOCCIncrements)
+{
+  TxnProcessor p(P_OCC);
+  CheckIncrements(&p, 400, 0.0001);
+  END;
+}
+
+TEST(SiloIncrements)
+{
+  {
+    TxnProcessor p(SILO);
+    CheckIncrements(&p, 400, 0.0001);
+  }
+  TxnProcessor p(SILO);
+  CheckConsistentReads(&p, 400, 0.0001);
+  END;
+}
+
+TEST(TicTocIncrements)
+{
+  {
+    TxnProcessor p(TICTOC);
+    CheckIncrements(&p, 400, 0.0001);
+  }
+  TxnProcessor p(TICTOC);
+  CheckConsistentReads(&p, 400, 0.0001);
+  END;
+}
+
+// Short txns finish together and are validated in the same batch. Those that
+// conflict with an earlier txn of their batch must fail, and those that only
+// share signature bits with it must not.
+TEST(OCCBatchValidation)
+{
+  {
+    TxnProcessor p(OCC);
+    CheckIncrements(&p, 2000, 0);
+  }
+  {
+    TxnProcessor p(OCC);
+    CheckConsistentReads(&p, 2000, 0);
+  }
+
+  TxnProcessor p(OCC);
+  vector<Txn *> txns;
+  for (int i = 0; i < 1000; i++)
+  {
+    set<Key> readset, writeset;
+    readset.insert(2000 + i);
+    writeset.insert(i);
+    txns.push_back(new RMW(readset, writeset, 0));
+  }
+  EXPECT_EQ(1000, RunTxns(&p, txns));
+  EXPECT_EQ(0, p.Restarts());
+  END;
+}
+
+// With early lock release, a txn can read the writes of one that has not been
+// reported yet, and must then not be reported before it. Each txn here reads
+// the value written by the previous one, so they must be reported in order.
+TEST(EarlyLockRelease)
+{
+  EARLY_LOCK_RELEASE = true;
+  CCMode modes[] = {LOCKING, CALVIN, VLL};
+  for (int i = 0; i < 3; i++)
+  {
+    TxnProcessor p(modes[i]);
+    for (int j = 0; j < 1000; j++)
+      p.NewTxnRequest(new Increment(3));
+
+    Value reported = 0;
+    for (int j = 0; j < 1000; j++)
+    {
+      Increment *txn = dynamic_cast<Increment *>(p.GetTxnResult());
+      EXPECT_EQ(COMMITTED, txn->Status());
+      EXPECT_EQ(reported, txn->read_);
+      reported = txn->read_ + 1;
+      delete txn;
+    }
+
+    map<Key, Value> values;
+    values[3] = 1000;
+    EXPECT_TRUE(Holds(&p, values));
+  }
+  EARLY_LOCK_RELEASE = false;
+  END;
+}
+
+// A long OCC txn whose read is overwritten while it runs gives up as soon as
+// it revalidates, instead of only failing validation at the end, and then
+// still commits once restarted.
+TEST(OCCEarlyAbort)
+{
+  for (int early_abort = 0; early_abort < 2; early_abort++)
+  {
+    OCC_EARLY_ABORT = early_abort == 1;
+    TxnProcessor p(OCC);
+    SlowIncrement *slow = new SlowIncrement(0, 1, 0.05);
+    p.NewTxnRequest(slow);
+
+    // overwrite key 0 while the slow txn runs
+    set<Key> writeset;
+    writeset.insert(0);
+    for (int i = 0; i < 20; i++)
+    {
+      usleep(5000);
+      p.NewTxnRequest(new RMW(writeset, 0));
+    }
+
+    for (int i = 0; i < 21; i++)
+    {
+      Txn *txn = p.GetTxnResult();
+      EXPECT_EQ(COMMITTED, txn->Status());
+      if (txn != slow)
+        delete txn;
+    }
+    EXPECT_TRUE(p.Restarts() > 0);
+    if (OCC_EARLY_ABORT)
+      EXPECT_TRUE(slow->early_aborts_ > 0);
+    else
+      EXPECT_EQ(0, slow->early_aborts_);
+    delete slow;
+
+    map<Key, Value> values;
+    values[0] = 20;
+    values[1] = 1;
+    EXPECT_TRUE(Holds(&p, values));
+  }
+  OCC_EARLY_ABORT = false;
+  END;
+}
+
+// Repaired OCC txns reread only what changed, so they must still see a
+// consistent state and lose no increment, as restarted ones do.
+TEST(OCCRepair)
+{
+  CCMode modes[] = {OCC, P_OCC};
+  for (int i = 0; i < 2; i++)
+  {
+    for (int repair = 0; repair < 2; repair++)
+    {
+      TXN_REPAIR = repair == 1;
+      {
+        TxnProcessor p(modes[i]);
+        CheckIncrements(&p, 400, 0.0001);
+      }
+      TxnProcessor p(modes[i]);
+      CheckConsistentReads(&p, 400, 0.0001);
+    }
+  }
+  TXN_REPAIR = false;
+  END;
+}
+
+// MVCC txns read at their own timestamp, so without timestamp ordering two
+// of them could read the same version of a key and both increment it.
+TEST(MVCCIncrements)
+{
+  TxnProcessor p(MVCC);
+  CheckIncrements(&p, 400, 0.0001);
+  END;
+}
+
+// Both txns of a pair read their snapshot before either commits, and they
+// write different keys, so SI lets both of them commit.
+TEST(SIWriteSkew)
+{
+  {
+    TxnProcessor p(SI);
+    CheckIncrements(&p, 400, 0.0001);
+  }
+  TxnProcessor p(SI);
+  EXPECT_EQ(10, WriteSkews(&p, 10));
+
+  // txns that vote to abort are not committed anyway
+  map<Key, Value> values;
+  values[10] = 1;
+  EXPECT_FALSE(Holds(&p, values));
+  END;
+}
+
+// SSI aborts one txn of each pair, which then sees the other's write and
+// leaves its own key alone, and so does MVCC, which is serializable too.
+TEST(SSIWriteSkew)
+{
+  {
+    TxnProcessor p(SSI);
+    CheckIncrements(&p, 400, 0.0001);
+  }
+  CCMode modes[] = {SSI, MVCC};
+  for (int i = 0; i < 2; i++)
+  {
+    TxnProcessor p(modes[i]);
+    EXPECT_EQ(0, WriteSkews(&p, 10));
+  }
+  END;
+}
+
+// Read-only txns read a snapshot below every writer that has not finished,
+// so under MVCC they never see part of a txn's writes, and never abort for
+// it. SI and SSI txns read their own snapshot.
+TEST(MVCCSnapshotReads)
+{
+  CCMode modes[] = {MVCC, SI, SSI};
+  for (int i = 0; i < 3; i++)
+  {
+    TxnProcessor p(modes[i]);
+    CheckConsistentReads(&p, 400, 0.0001);
+  }
+  END;
+}
+
+// All txns increment the same key at once, so most of them fail validation
+// and are backed off, and under OCC and MVCC many are restarted often enough
+// to be escalated. Each of them must still commit exactly once.
+TEST(RestartEscalation)
+{
+  CCMode modes[] = {OCC, P_OCC, SILO, TICTOC, MVCC, SI, SSI};
+  for (int i = 0; i < 7; i++)
+  {
+    TxnProcessor p(modes[i]);
+    set<Key> writeset;
+    writeset.insert(9);
+    vector<Txn *> txns;
+    for (int j = 0; j < 200; j++)
+      txns.push_back(new RMW(writeset, 0.0001));
+    EXPECT_EQ(200, RunTxns(&p, txns));
+
+    map<Key, Value> values;
+    values[9] = 200;
+    EXPECT_TRUE(Holds(&p, values));
+    EXPECT_TRUE(p.EscalatedRestarts() <= p.Restarts());
+    if (modes[i] == OCC || modes[i] == MVCC)
+      EXPECT_TRUE(p.EscalatedRestarts() > 0);
+  }
+  END;
+}
+
+TEST(LockEscalation)
+{
+  // txns of three keys lock whole granules, txns of two keys lock records
+  set<Key> wide, narrow;
+  wide.insert(0);
+  wide.insert(LOCK_GRANULE_SIZE);
+  wide.insert(2 * LOCK_GRANULE_SIZE);
+  narrow.insert(LOCK_GRANULE_SIZE);
+  narrow.insert(2 * LOCK_GRANULE_SIZE + 1);
+
+  CCMode modes[] = {LOCKING, LOCKING, CALVIN};
+  DeadlockPolicy policies[] = {DETECT, WAIT_DIE, ORDERED};
+  for (int i = 0; i < 3; i++)
+  {
+    TxnProcessor p(modes[i], policies[i], 2);
+    vector<Txn *> txns;
+    for (int j = 0; j < 200; j++)
+      txns.push_back(new RMW(j % 2 == 0 ? wide : narrow));
+    EXPECT_EQ(200, RunTxns(&p, txns));
+
+    map<Key, Value> values;
+    values[0] = 100;
+    values[LOCK_GRANULE_SIZE] = 200;
+    values[2 * LOCK_GRANULE_SIZE] = 100;
+    values[2 * LOCK_GRANULE_SIZE + 1] = 100;
+    EXPECT_TRUE(Holds(&p, values));
+  }
+  END;
+}
+
+TEST(OrderedLockEscalation)
+{
+  // Txns that read the key the other one writes, across three granules.
+  // Requested key by key, their locks could deadlock, and ORDERED never
+  // aborts a txn.
+  set<Key> a, b;
+  a.insert(1);
+  a.insert(LOCK_GRANULE_SIZE + 1);
+  a.insert(2 * LOCK_GRANULE_SIZE + 1);
+  b.insert(2);
+  b.insert(LOCK_GRANULE_SIZE + 2);
+
+  for (int threshold = 1; threshold <= 3; threshold++)
+  {
+    TxnProcessor p(LOCKING, ORDERED, threshold);
+    vector<Txn *> txns;
+    for (int i = 0; i < 1000; i++)
+      txns.push_back(i % 2 == 0 ? new RMW(a, b) : new RMW(b, a));
+    EXPECT_EQ(1000, RunTxns(&p, txns));
+    EXPECT_EQ(0, p.DeadlockAborts());
+
+    map<Key, Value> values;
+    values[1] = 500;
+    values[2] = 500;
+    values[LOCK_GRANULE_SIZE + 1] = 500;
+    values[LOCK_GRANULE_SIZE + 2] = 500;
+    values[2 * LOCK_GRANULE_SIZE + 1] = 500;
+    EXPECT_TRUE(Holds(&p, values));
+  }
+  END;
+}
+
 void Benchmark(const vector<LoadGen *> &lg)
 {
   // Number of transaction requests that can be active at any given time.
@@ -89,7 +655,7 @@ void Benchmark(const vector<LoadGen *> &lg)
 
   // For each MODE...
   for (CCMode mode = SERIAL;
-       mode <= MVCC;
+       mode <= SSI;
        mode = static_cast<CCMode>(mode + 1))
   {
     // FILTER modes for testing
@@ -145,6 +711,21 @@ void Benchmark(const vector<LoadGen *> &lg)
 
 int main(int argc, char **argv)
 {
+  LockEscalation();
+  OrderedLockEscalation();
+  ParallelOCCIncrements();
+  SiloIncrements();
+  TicTocIncrements();
+  EarlyLockRelease();
+  OCCBatchValidation();
+  OCCEarlyAbort();
+  OCCRepair();
+  MVCCIncrements();
+  SIWriteSkew();
+  SSIWriteSkew();
+  MVCCSnapshotReads();
+  RestartEscalation();
+
   cout << "\t\t\t    Average Transaction Duration" << endl;
   cout << "\t\t0.1ms\t\t1ms\t\t10ms";
   cout << endl;
@@ -0,0 +1,100 @@
+#include "txn/txn.h"
+
+#include <set>
+
+#include "txn/txn_types.h"
+#include "utils/testing.h"
+
+using std::set;
+
+TEST(Signature_SharedKeys)
+{
+  Signature empty;
+  Signature a;
+  Signature b;
+  for (Key key = 0; key < 100; key++)
+  {
+    a.Add(key);
+    b.Add(key + 99);
+  }
+
+  // no key was added to 'empty', so nothing can be in common with it
+  EXPECT_FALSE(empty.Intersects(a));
+  EXPECT_FALSE(a.Intersects(empty));
+
+  // a Bloom filter has no false negatives
+  EXPECT_TRUE(a.Intersects(b));
+  EXPECT_TRUE(b.Intersects(a));
+  for (Key key = 0; key < 100; key++)
+  {
+    Signature one;
+    one.Add(key);
+    EXPECT_TRUE(a.Intersects(one));
+  }
+
+  // the union of two signatures holds the keys of both
+  Signature both;
+  both.Add(a);
+  both.Add(b);
+  Signature last;
+  last.Add(198);
+  EXPECT_TRUE(both.Intersects(last));
+  EXPECT_FALSE(empty.Intersects(both));
+
+  both.Clear();
+  EXPECT_FALSE(both.Intersects(a));
+
+  END;
+}
+
+TEST(Signature_DisjointKeys)
+{
+  // consecutive keys are spread over the whole filter, so small sets of them
+  // rarely share a bit
+  int false_positives = 0;
+  for (Key key = 0; key < 1000; key++)
+  {
+    Signature one;
+    Signature next;
+    one.Add(key);
+    next.Add(key + 1);
+    if (one.Intersects(next))
+      false_positives++;
+  }
+  EXPECT_TRUE(false_positives < 50);
+
+  END;
+}
+
+TEST(Txn_MayConflictWith)
+{
+  set<Key> k1, k2, k3;
+  k1.insert(1);
+  k2.insert(2);
+  k3.insert(3);
+
+  // reads 1, writes 2
+  RMW reader(k1, k2, 0);
+  // writes 1
+  RMW writer(k1, 0);
+  // writes 3
+  RMW other(k3, 0);
+  reader.ComputeSignatures();
+  writer.ComputeSignatures();
+  other.ComputeSignatures();
+
+  // only the other txn's writes count, so a conflict goes one way
+  EXPECT_TRUE(reader.MayConflictWith(writer));
+  EXPECT_FALSE(writer.MayConflictWith(reader));
+  EXPECT_FALSE(reader.MayConflictWith(other));
+  EXPECT_FALSE(other.MayConflictWith(reader));
+
+  END;
+}
+
+int main(int argc, char **argv)
+{
+  Signature_SharedKeys();
+  Signature_DisjointKeys();
+  Txn_MayConflictWith();
+}
@@ -8,6 +8,10 @@
 
 #include "txn/txn.h"
 
+// Number of times an RMW txn checks its reads with Revalidate() while it
+// runs, spread evenly over its duration.
+#define REVALIDATE_CHECKS 8
+
 // Immediately commits.
 class Noop : public Txn {
  public:
@@ -132,9 +136,17 @@ class RMW : public Txn {
       Write(*it, result + 1);
     }
 
-    // Run while loop to simulate the txn logic(duration is time_).
+    // Run while loop to simulate the txn logic(duration is time_), giving up
+    // early if our reads go stale.
     double begin = GetTime();
-    while (GetTime() - begin < time_) {
+    double interval = time_ / REVALIDATE_CHECKS;
+    double next_check = begin + interval;
+    for (double now = begin; now - begin < time_; now = GetTime()) {
+      if (now >= next_check) {
+        if (!Revalidate())
+          ABORT;
+        next_check = now + interval;
+      }
       for (int i = 0;i < 1000; i++) {
         int x = 100;
         x = x + 2;
@@ -39,6 +39,19 @@ class Condition {
     m_->Unlock();
   }
 
+  /// Like Wait(), but for a caller that already holds the mutex. The mutex is
+  /// released while the thread sleeps, and held again when the call returns.
+  inline void WaitLocked() {
+    pthread_cond_wait(&cv_, &m_->mutex_);
+  }
+
+  /// Wakes up every thread waiting on the condition variable.
+  ///
+  /// Requires: The mutex is held by the caller.
+  inline void BroadcastLocked() {
+    pthread_cond_broadcast(&cv_);
+  }
+
   /// Signals all threads waiting on the condition variable to wake up and
   /// continue execution.
   inline void Signal() {
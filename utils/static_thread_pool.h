@@ -27,6 +27,15 @@ class StaticThreadPool : public ThreadPool {
 
 
   ~StaticThreadPool() {
+    Stop();
+  }
+
+  // Stops the pool: every worker runs the tasks still in its queue and exits.
+  // Blocks until all worker threads have been joined. Calling Stop() on an
+  // already stopped pool has no effect.
+  void Stop() {
+    if (stopped_)
+      return;
     stopped_ = true;
     for (int i = 0; i < thread_count_; i++)
       pthread_join(threads_[i], NULL);
@@ -140,6 +149,15 @@ class StaticThreadPool : public ThreadPool {
 
 
   ~StaticThreadPool() {
+    Stop();
+  }
+
+  // Stops the pool: every worker runs the tasks still in its queue and exits.
+  // Blocks until all worker threads have been joined. Calling Stop() on an
+  // already stopped pool has no effect.
+  void Stop() {
+    if (stopped_)
+      return;
     stopped_ = true;
     for (int i = 0; i < thread_count_; i++)
       pthread_join(threads_[i], NULL);